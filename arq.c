@@ -0,0 +1,452 @@
+#include "arq.h"
+#include "trace.h"
+#include "evlog.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+static const uint8_t zero_padding[MIN_FRAME_SIZE];
+
+// Describe a stored frame for sending; a referenced payload is gathered in
+// place between the stored header and the padding
+static int slot_iov(ArqSender *s, uint8_t seq, struct iovec *iov) {
+    if (s->extended & (1u << seq)) {
+        size_t size = s->payload_size[seq];
+        iov[0].iov_base = &s->frames[seq];
+        iov[0].iov_len = EXT_HEADER_SIZE;
+        iov[1].iov_base = (void *)s->payload[seq];
+        iov[1].iov_len = size;
+        if (EXT_HEADER_SIZE + size >= MIN_FRAME_SIZE) return 2;
+
+        // Short frames still fill the Ethernet minimum
+        iov[2].iov_base = (void *)zero_padding;
+        iov[2].iov_len = MIN_FRAME_SIZE - EXT_HEADER_SIZE - size;
+        return 3;
+    }
+
+    size_t size = s->frames[seq].size_seq_type >> 1;
+    if (!s->payload[seq]) {
+        iov[0].iov_base = &s->frames[seq];
+        iov[0].iov_len = packet_wire_size(size);
+        return 1;
+    }
+
+    iov[0].iov_base = &s->frames[seq];
+    iov[0].iov_len = PACKET_HEADER_SIZE;
+    iov[1].iov_base = (void *)s->payload[seq];
+    iov[1].iov_len = size;
+    if (PACKET_HEADER_SIZE + size >= MIN_FRAME_SIZE) return 2;
+
+    iov[2].iov_base = (void *)zero_padding;
+    iov[2].iov_len = MIN_FRAME_SIZE - PACKET_HEADER_SIZE - size;
+    return 3;
+}
+
+// Send every queued frame with one sendmmsg
+void arq_transmit_pending(ArqSender *s) {
+    if (s->tx_count == 0) return;
+
+    struct mmsghdr msgs[ARQ_TX_BATCH];
+    struct iovec iov[ARQ_TX_BATCH][3];
+    size_t bytes = 0;
+
+    for (int i = 0; i < s->tx_count; i++) {
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &s->addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = slot_iov(s, s->tx_queue[i], iov[i]);
+        for (size_t j = 0; j < msgs[i].msg_hdr.msg_iovlen; j++) {
+            bytes += iov[i][j].iov_len;
+        }
+    }
+    if (s->stats) {
+        stats_add(&s->stats->c.frames_sent, s->tx_count);
+        stats_add(&s->stats->c.bytes_sent, bytes);
+    }
+
+    // A failed send is recovered by the retransmission timer
+    socket_send_batch(s->socket_fd, msgs, s->tx_count);
+    s->tx_count = 0;
+}
+
+// Queue a stored frame for the next batch
+static void transmit_slot(ArqSender *s, uint8_t seq) {
+    if (s->tx_count == ARQ_TX_BATCH) {
+        arq_transmit_pending(s);
+    }
+    s->tx_queue[s->tx_count++] = seq;
+    s->transmissions++;
+}
+
+// Send a frame again; its ACK can no longer be timed
+static void retransmit_slot(ArqSender *s, uint8_t seq) {
+    s->retransmitted |= 1u << seq;
+    s->retransmissions++;
+    if (s->stats) stats_add(&s->stats->c.retransmits, 1);
+    if (evlog_on()) {
+        evlog_record(EV_RETRANSMIT, s->addr.sll_addr, seq, 0, 0, 0, s->retransmissions, 0);
+    }
+    transmit_slot(s, seq);
+}
+
+static void restart_timer(ArqSender *s) {
+    s->deadline = get_timestamp_us() + rtt_timeout_us(s->rtt);
+}
+
+// Resend outstanding frames starting at base: all of them for go-back-N,
+// only those the receiver has not reported for selective repeat
+static void retransmit_window(ArqSender *s) {
+    for (int i = 0; i < s->in_flight; i++) {
+        uint8_t seq = seq_add(s->base, i);
+        if (s->mode == ARQ_SELECTIVE_REPEAT && (s->sacked & (1u << seq))) continue;
+        retransmit_slot(s, seq);
+    }
+    s->resent = 0;
+    restart_timer(s);
+}
+
+// Selective repeat: record the frames held by the receiver and resend the
+// holes below the highest one, once per timer period
+static void handle_sack(ArqSender *s, const Packet *ack) {
+    uint16_t bitmap = ((uint16_t)ack->data[0] << 8) | ack->data[1];
+
+    // Bit i reports frame ack->seq + 2 + i (ack->seq + 1 is the gap)
+    for (int i = 0; i < 16; i++) {
+        if (!(bitmap & (1u << i))) continue;
+        uint8_t seq = seq_add(ack->seq, 2 + i);
+        int offset = seq_diff(seq, s->base);
+        if (offset >= 0 && offset < s->in_flight) {
+            s->sacked |= 1u << seq;
+        }
+    }
+
+    int highest = -1;
+    for (int i = 0; i < s->in_flight; i++) {
+        if (s->sacked & (1u << seq_add(s->base, i))) highest = i;
+    }
+
+    for (int i = 0; i < highest; i++) {
+        uint8_t seq = seq_add(s->base, i);
+        uint32_t bit = 1u << seq;
+        if ((s->sacked | s->resent) & bit) continue;
+        retransmit_slot(s, seq);
+        s->resent |= bit;
+    }
+}
+
+void arq_sender_init(ArqSender *s, int socket_fd, const struct sockaddr_ll *addr,
+                     ArqMode mode, int window, uint8_t first_seq, RttEstimator *rtt) {
+    memset(s, 0, sizeof(*s));
+    s->socket_fd = socket_fd;
+    s->addr = *addr;
+    s->mode = mode;
+    s->rtt = rtt;
+
+    // The receiver holds frames up to half the sequence space ahead, so a
+    // larger window would let old retransmissions alias new frames
+    int max_window = (mode == ARQ_SELECTIVE_REPEAT) ? SR_MAX_WINDOW : GBN_MAX_WINDOW;
+    if (window < 1) window = 1;
+    if (window > max_window) window = max_window;
+    s->window = window;
+
+    s->base = first_seq & (SEQ_MODULO - 1);
+    s->next_seq = s->base;
+}
+
+int arq_window_full(const ArqSender *s) {
+    return s->in_flight >= s->window;
+}
+
+// frames[next_seq] is ready: account for it and put it on the wire
+static void send_new_slot(ArqSender *s) {
+    uint8_t seq = s->next_seq;
+
+    // The timer always tracks the oldest outstanding frame
+    if (s->in_flight == 0) {
+        restart_timer(s);
+    }
+
+    s->sent_at[seq] = get_timestamp_us();
+    s->retransmitted &= ~(1u << seq);
+    s->next_seq = seq_add(seq, 1);
+    s->in_flight++;
+
+    transmit_slot(s, seq);
+}
+
+// Assign the next sequence number to pkt and send it; the window must have room
+int arq_transmit(ArqSender *s, Packet *pkt) {
+    return arq_transmit_ref(s, pkt, NULL);
+}
+
+// Like arq_transmit, but the payload is read from `payload` (which must stay
+// valid until the frame is acknowledged) instead of being copied out of pkt
+int arq_transmit_ref(ArqSender *s, Packet *pkt, const uint8_t *payload) {
+    if (!pkt || arq_window_full(s)) return -1;
+
+    pkt->start_marker = START_MARKER;
+    pkt->seq = s->next_seq;
+    if (payload) {
+        pkt->checksum = calculate_crc_data(pkt, payload);
+        pack_header(pkt, &s->frames[pkt->seq]);
+    } else {
+        pkt->checksum = calculate_crc(pkt);
+        pack_packet(pkt, &s->frames[pkt->seq]);
+    }
+    s->payload[pkt->seq] = payload;
+    s->extended &= ~(1u << pkt->seq);
+
+    send_new_slot(s);
+    return 0;
+}
+
+// Send a frame encoded ahead of time with seq 0: only the header is
+// patched, and the payload is read from the encoded frame in place
+int arq_transmit_encoded(ArqSender *s, const PacketRaw *frame) {
+    if (!frame || arq_window_full(s)) return -1;
+
+    PacketRaw *slot = &s->frames[s->next_seq];
+    memcpy(slot, frame, PACKET_HEADER_SIZE);
+    patch_seq(slot, s->next_seq);
+    s->payload[s->next_seq] = frame->data;
+    s->extended &= ~(1u << s->next_seq);
+
+    send_new_slot(s);
+    return 0;
+}
+
+// Send an extended frame (negotiated via PKT_EXTENSION) whose payload is
+// read in place, like arq_transmit_ref; EXT_TYPE_CRC8 in type picks the CRC
+int arq_transmit_ext(ArqSender *s, uint8_t type, const uint8_t *payload, uint16_t size) {
+    if (!payload || size > EXT_MAX_DATA_SIZE || arq_window_full(s)) return -1;
+
+    uint8_t seq = s->next_seq;
+    encode_ext_header((uint8_t *)&s->frames[seq], seq, type, payload, size);
+    s->payload[seq] = payload;
+    s->payload_size[seq] = size;
+    s->extended |= 1u << seq;
+
+    send_new_slot(s);
+    return 0;
+}
+
+// Process a cumulative ACK (or NACK); returns how many frames left the window
+int arq_handle_ack(ArqSender *s, const Packet *ack) {
+    if (!ack || s->in_flight == 0) return 0;
+
+    int acked;
+    if (ack->type == PKT_ACK) {
+        acked = seq_diff(ack->seq, s->base) + 1;   // ACK n confirms everything up to n
+    } else if (ack->type == PKT_NACK) {
+        acked = seq_diff(ack->seq, s->base);       // NACK n confirms everything before n
+    } else {
+        return 0;
+    }
+
+    // Stale or out-of-window acknowledgements are ignored
+    if (acked < 0 || acked > s->in_flight) return 0;
+    if (acked == 0 && ack->type == PKT_ACK && s->stats) {
+        stats_add(&s->stats->c.duplicates, 1);
+    }
+
+    long long sample = -1;
+    if (acked > 0) {
+        // The newest frame covered by an ACK is the one that triggered it
+        uint8_t newest = seq_add(s->base, acked - 1);
+        if (ack->type == PKT_ACK && !(s->retransmitted & (1u << newest))) {
+            sample = get_timestamp_us() - s->sent_at[newest];
+            rtt_sample(s->rtt, sample);
+            if (s->stats) stats_rtt(s->stats, sample);
+        }
+
+        for (int i = 0; i < acked; i++) {
+            uint32_t bit = 1u << seq_add(s->base, i);
+            s->sacked &= ~bit;
+            s->resent &= ~bit;
+        }
+        s->base = seq_add(s->base, acked);
+        s->in_flight -= acked;
+        s->retries = 0;
+        restart_timer(s);
+    }
+    if (trace_on()) {
+        long long now_ns = trace_now_ns();
+        trace_record(TRACE_ACK, now_ns, now_ns, ack->seq, ack->type, ack->size, acked, sample);
+    }
+
+    if (s->in_flight == 0) return acked;
+
+    if (ack->type == PKT_NACK) {
+        if (s->mode == ARQ_SELECTIVE_REPEAT) {
+            retransmit_slot(s, s->base);  // Only the rejected frame
+        } else {
+            retransmit_window(s);
+        }
+    } else if (s->mode == ARQ_SELECTIVE_REPEAT && ack->size >= SACK_BITMAP_SIZE) {
+        handle_sack(s, ack);
+    }
+
+    // Retransmissions go out now; new frames wait for the caller's batch
+    arq_transmit_pending(s);
+    return acked;
+}
+
+// Retransmission timer expired: back off and resend
+int arq_handle_timeout(ArqSender *s) {
+    if (s->in_flight == 0) return 0;
+
+    if (s->stats) stats_add(&s->stats->c.timeouts, 1);
+    // A LAN's RTO is a millisecond, so retries alone would give up within
+    // a scheduler hiccup: the oldest frame must also have gone unanswered
+    // for PEER_GIVE_UP_US
+    s->retries++;
+    if (s->retries >= ARQ_MAX_RETRIES &&
+        get_timestamp_us() - s->sent_at[s->base] >= PEER_GIVE_UP_US) {
+        return -1;  // Peer is gone
+    }
+
+    rtt_backoff(s->rtt);  // Exponential backoff only while losses repeat
+    retransmit_window(s);
+    arq_transmit_pending(s);
+    return 0;
+}
+
+// Wait for one acknowledgement or for the retransmission timer
+int arq_poll(ArqSender *s) {
+    arq_transmit_pending(s);
+    if (s->in_flight == 0) return 0;
+
+    long long remaining = s->deadline - get_timestamp_us();
+    if (remaining > 0) {
+        Packet ack;
+        struct sockaddr_ll from;
+        if (receive_frame(s->socket_fd, &ack, &from, (int)((remaining + 999) / 1000)) > 0) {
+            arq_handle_ack(s, &ack);
+            return 0;
+        }
+    }
+
+    return arq_handle_timeout(s);
+}
+
+// Blocking send: waits for room in the window, then transmits
+int arq_send(ArqSender *s, Packet *pkt) {
+    while (arq_window_full(s)) {
+        if (arq_poll(s) < 0) return -1;
+    }
+    return arq_transmit(s, pkt);
+}
+
+// Block until every outstanding frame has been acknowledged
+int arq_flush(ArqSender *s) {
+    while (s->in_flight > 0) {
+        if (arq_poll(s) < 0) return -1;
+    }
+    return 0;
+}
+
+const char *arq_mode_name(ArqMode mode) {
+    return mode == ARQ_SELECTIVE_REPEAT ? "selective repeat" : "go-back-N";
+}
+
+// last_seq is the sequence number of the frame that opened the exchange
+void arq_receiver_init(ArqReceiver *r, uint8_t last_seq) {
+    memset(r, 0, sizeof(*r));
+    r->expected = seq_add(last_seq, 1);
+}
+
+// First sequence number not yet received: everything from `expected` that
+// sits in the reorder buffer counts as received
+static uint8_t next_missing(const ArqReceiver *r) {
+    uint8_t next = r->expected;
+    for (int i = 0; i < SEQ_MODULO - 1 && (r->held_mask & (1u << next)); i++) {
+        next = seq_add(next, 1);
+    }
+    return next;
+}
+
+// Acknowledge everything received in order (including held frames that
+// close the gap) plus a bitmap of the frames held beyond it
+static void send_sack(const ArqReceiver *r, int socket_fd, struct sockaddr_ll *addr) {
+    uint8_t next = next_missing(r);
+
+    uint16_t bitmap = 0;
+    for (int i = 0; i < 16; i++) {
+        if (r->held_mask & (1u << seq_add(next, 1 + i))) {
+            bitmap |= 1u << i;
+        }
+    }
+
+    Packet ack = {
+        .start_marker = START_MARKER,
+        .size = SACK_BITMAP_SIZE,
+        .seq = seq_add(next, -1),
+        .type = PKT_ACK,
+        .data = { bitmap >> 8, bitmap & 0xFF }
+    };
+    send_frame(socket_fd, &ack, addr);
+}
+
+// Take whatever frames are waiting with one recvmmsg and file them in the
+// reorder buffer; the batch is answered by a single ACK
+static void receive_batch(ArqReceiver *r, int socket_fd, struct sockaddr_ll *addr) {
+    uint8_t bufs[ARQ_RX_BATCH][MAX_FRAME_SIZE];
+    size_t lens[ARQ_RX_BATCH];
+    struct sockaddr_ll addrs[ARQ_RX_BATCH];
+
+    int count = socket_recv_batch(socket_fd, bufs, MAX_FRAME_SIZE, lens, addrs, ARQ_RX_BATCH);
+    int answer = 0;
+
+    for (int i = 0; i < count; i++) {
+        // Peek at the header before copying the payload out
+        Frame *slot;
+        uint8_t seq = bufs[i][0] == EXT_MARKER ? bufs[i][1] & 0x1F
+                                               : ((bufs[i][1] & 1) << 4) | (bufs[i][2] >> 4);
+        uint32_t bit = 1u << seq;
+        int offset = seq_diff(seq, next_missing(r));
+        int keep = offset >= 0 && offset < SR_MAX_WINDOW && !(r->held_mask & bit);
+
+        Frame scratch;
+        slot = keep ? &r->held[seq] : &scratch;
+        if (!decode_frame(bufs[i], lens[i], slot)) continue;
+
+        // Acknowledgements travel the other way
+        if (slot->type == PKT_ACK || slot->type == PKT_NACK) continue;
+
+        if (addr) *addr = addrs[i];
+        answer = 1;
+
+        // Duplicates and frames outside the window are only re-ACKed
+        if (keep) r->held_mask |= bit;
+    }
+
+    if (answer) send_sack(r, socket_fd, addr);
+}
+
+// Receive the next in-order frame. Frames are buffered as they arrive and
+// delivered from the reorder buffer, which also covers frames that came early.
+// A zero timeout only takes what the socket already holds.
+ssize_t arq_receive(ArqReceiver *r, int socket_fd, Frame *frame, struct sockaddr_ll *addr,
+                    int timeout_ms) {
+    long long deadline = get_timestamp_ms() + timeout_ms;
+
+    while (!(r->held_mask & (1u << r->expected))) {
+        long long remaining = deadline - get_timestamp_ms();
+        if (remaining < 0) return -1;
+
+        // Keep our own clock: stray frames must not restart the wait
+        int ready = socket_wait(socket_fd, (int)remaining);
+        if (ready < 0 || (ready == 0 && timeout_ms == 0)) return -1;
+        if (ready > 0) receive_batch(r, socket_fd, addr);
+    }
+
+    Frame *held = &r->held[r->expected];
+    frame->seq = held->seq;
+    frame->type = held->type;
+    frame->size = held->size;
+    memcpy(frame->data, held->data, held->size);
+    r->held_mask &= ~(1u << r->expected);
+    r->expected = seq_add(r->expected, 1);
+    return sizeof(Frame);
+}
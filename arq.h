@@ -0,0 +1,93 @@
+// arq.h
+#ifndef ARQ_H
+#define ARQ_H
+
+#include "sockets.h"
+#include "stats.h"
+
+#define SEQ_MODULO         32   // 5-bit sequence field
+#define GBN_DEFAULT_WINDOW 3    // Window size from the spec's go-back-N option
+// Selective repeat needs half the space, less one: a cumulative ACK that
+// arrives after a later one must not pass for an ACK of the current window
+#define SR_MAX_WINDOW      (SEQ_MODULO / 2 - 1)
+#define GBN_MAX_WINDOW     SR_MAX_WINDOW     // The receiver buffers ahead for both modes
+#define SACK_BITMAP_SIZE   2    // ACK payload: frames received after the cumulative ACK
+
+#define ARQ_MAX_RETRIES        5    // Timeouts before giving up, once PEER_GIVE_UP_US has passed too
+#define ARQ_TX_BATCH          32   // Frames handed to the kernel per sendmmsg
+#define ARQ_RX_BATCH          16   // Frames taken per recvmmsg, answered by one ACK
+
+// Serial number arithmetic: signed distance from b to a in the 5-bit space
+static inline int seq_diff(uint8_t a, uint8_t b) {
+    int diff = (a - b) & (SEQ_MODULO - 1);
+    return diff >= SEQ_MODULO / 2 ? diff - SEQ_MODULO : diff;
+}
+
+static inline uint8_t seq_add(uint8_t seq, int n) {
+    return (uint8_t)((seq + n) & (SEQ_MODULO - 1));
+}
+
+typedef enum {
+    ARQ_GO_BACK_N,        // A loss resends the whole window
+    ARQ_SELECTIVE_REPEAT  // A loss resends only the frames the receiver is missing
+} ArqMode;
+
+// Sliding window sender: keeps up to `window` unacknowledged frames in flight
+typedef struct {
+    int socket_fd;
+    struct sockaddr_ll addr;
+    ArqMode mode;
+    int window;
+    uint8_t base;            // Oldest unacknowledged sequence number
+    uint8_t next_seq;        // Sequence number for the next new frame
+    int in_flight;           // Frames sent but not yet acknowledged
+    PacketRaw frames[SEQ_MODULO];  // Copies kept for retransmission, indexed by seq
+    const uint8_t *payload[SEQ_MODULO]; // Payload kept by the caller instead of in frames
+    uint16_t payload_size[SEQ_MODULO];  // Extended frames: payload length
+    uint32_t extended;       // Frames with an extended header (bit per seq)
+    long long sent_at[SEQ_MODULO]; // First transmission time (us), for RTT samples
+    uint32_t retransmitted;  // Frames sent more than once: no RTT sample (Karn)
+    uint32_t sacked;         // Selective repeat: frames the receiver already holds (bit per seq)
+    uint32_t resent;         // Selective repeat: holes already resent since the last timeout
+    RttEstimator *rtt;       // Per-peer estimator that sets the timeout
+    long long deadline;      // Retransmission timer for the oldest frame (us)
+    int retries;             // Consecutive timeouts without progress
+    unsigned long transmissions;    // Frames handed to the socket, first sends included
+    unsigned long retransmissions;  // Of those, frames sent again
+    PeerStats *stats;        // Per-peer counters to update as well (NULL = none)
+    uint8_t tx_queue[ARQ_TX_BATCH];  // Slots waiting to go out in the next batch
+    int tx_count;
+} ArqSender;
+
+// Receiver: buffers frames that arrive early and delivers them in order.
+// ACKs are cumulative and carry a bitmap of the frames held past the gap,
+// so they work for both go-back-N and selective repeat senders.
+typedef struct {
+    uint8_t expected;        // Next in-order sequence number
+    uint32_t held_mask;      // Reorder buffer occupancy (bit per seq)
+    Frame held[SEQ_MODULO];  // Reorder buffer, indexed by seq
+} ArqReceiver;
+
+// Sender
+void arq_sender_init(ArqSender *s, int socket_fd, const struct sockaddr_ll *addr,
+                     ArqMode mode, int window, uint8_t first_seq, RttEstimator *rtt);
+int  arq_window_full(const ArqSender *s);
+int  arq_transmit(ArqSender *s, Packet *pkt);
+int  arq_transmit_ref(ArqSender *s, Packet *pkt, const uint8_t *payload);
+int  arq_transmit_encoded(ArqSender *s, const PacketRaw *frame);
+int  arq_transmit_ext(ArqSender *s, uint8_t type, const uint8_t *payload, uint16_t size);
+void arq_transmit_pending(ArqSender *s);
+int  arq_handle_ack(ArqSender *s, const Packet *ack);
+int  arq_handle_timeout(ArqSender *s);
+int  arq_poll(ArqSender *s);
+int  arq_send(ArqSender *s, Packet *pkt);
+int  arq_flush(ArqSender *s);
+
+// Receiver
+void    arq_receiver_init(ArqReceiver *r, uint8_t last_seq);
+ssize_t arq_receive(ArqReceiver *r, int socket_fd, Frame *frame, struct sockaddr_ll *addr,
+                    int timeout_ms);
+
+const char *arq_mode_name(ArqMode mode);
+
+#endif // ARQ_H
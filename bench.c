@@ -0,0 +1,386 @@
+// bench.c
+// Transfer benchmark: pushes synthetic treasures through the ARQ sender and
+// receiver the server and client use, over a simulated link or a veth pair,
+// and prints one JSON object with a result per size and loss rate
+#include "arq.h"
+#include "transport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#define BENCH_MAX_ENTRIES  16     // Sizes and loss rates per run
+#define BENCH_TIMEOUT_MS   5000   // Receiver gives up after this much silence
+#define BENCH_LINGER_MS    10     // Receiver checks this often whether the sender is done
+
+typedef struct {
+    ArqMode mode;
+    int window;
+    int extended;               // Extended frames instead of the spec's 127 bytes
+    uint8_t ext_type_flags;     // EXT_TYPE_CRC8 to check extended frames with the CRC
+    const char *ifaces[2];      // veth pair (sender, receiver); NULL = simulated link
+    LinkConfig link;            // Impairments other than loss
+    size_t sizes[BENCH_MAX_ENTRIES];
+    int size_count;
+    double losses[BENCH_MAX_ENTRIES];
+    int loss_count;
+} BenchConfig;
+
+// One transfer: the sender runs in main, the receiver in its own thread
+typedef struct {
+    int fds[2];
+    struct sockaddr_ll peer;    // Where the sender's frames go
+    const uint8_t *data;
+    size_t size;
+    uint16_t payload;           // Data bytes per frame
+    uint8_t ext_type_flags;
+    size_t frames;
+    long long *sent_at;         // First transmission of each frame (us)
+    long long *delivered_at;    // In-order delivery of each frame (us)
+    size_t received;
+    int intact;                 // Everything arrived, in order and unchanged
+    _Atomic int sender_done;    // arq_flush returned: no more retransmissions to answer
+} Transfer;
+
+typedef struct {
+    int ok;
+    double seconds;
+    unsigned long transmissions;
+    unsigned long retransmissions;
+    long long p50_us, p99_us;
+    double cpu_user, cpu_sys;
+} Result;
+
+static void *receive_treasure(void *arg) {
+    Transfer *t = arg;
+    ArqReceiver r;
+    Frame frame;
+    struct sockaddr_ll from;
+    size_t index = 0;
+
+    arq_receiver_init(&r, SEQ_MODULO - 1);
+    t->intact = 1;
+    while (1) {
+        if (arq_receive(&r, t->fds[1], &frame, &from, BENCH_TIMEOUT_MS) < 0) {
+            t->intact = 0;
+            return NULL;
+        }
+        if (frame.type == PKT_END_FILE) break;
+
+        if (index >= t->frames || t->received + frame.size > t->size ||
+            memcmp(frame.data, t->data + t->received, frame.size) != 0) {
+            t->intact = 0;
+        } else {
+            t->delivered_at[index++] = get_timestamp_us();
+        }
+        t->received += frame.size;
+    }
+    if (t->received != t->size) t->intact = 0;
+
+    // Our last ACK may be lost: answer retransmissions until the sender is done
+    while (!atomic_load(&t->sender_done)) {
+        arq_receive(&r, t->fds[1], &frame, &from, BENCH_LINGER_MS);
+    }
+    return NULL;
+}
+
+// Window-limited sending, as pump_transfer does it in the server
+static int send_treasure(Transfer *t, ArqSender *s) {
+    for (size_t i = 0; i < t->frames; i++) {
+        while (arq_window_full(s)) {
+            if (arq_poll(s) < 0) return -1;
+        }
+
+        size_t offset = i * t->payload;
+        uint16_t size = t->size - offset < t->payload ? t->size - offset : t->payload;
+        t->sent_at[i] = get_timestamp_us();
+        if (t->payload > MAX_DATA_SIZE) {
+            arq_transmit_ext(s, PKT_DATA | t->ext_type_flags, t->data + offset, size);
+        } else {
+            Packet pkt = { .size = size, .type = PKT_DATA };
+            arq_transmit_ref(s, &pkt, t->data + offset);
+        }
+    }
+
+    Packet end = { .type = PKT_END_FILE };
+    if (arq_send(s, &end) < 0) return -1;
+    return arq_flush(s);
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static double cpu_seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// Connect the two ends for one run
+static int open_link(const BenchConfig *cfg, double loss, int *mtu_payload, Transfer *t) {
+    if (!cfg->ifaces[0]) {
+        LinkConfig link = cfg->link;
+        link.loss = loss;
+        if (transport_simlink(&link, t->fds) < 0) return -1;
+        memset(&t->peer, 0, sizeof(t->peer));
+        *mtu_payload = EXT_MAX_DATA_SIZE;
+        return 0;
+    }
+
+    t->fds[0] = create_raw_socket(cfg->ifaces[0]);
+    if (t->fds[0] < 0) return -1;
+    t->fds[1] = create_raw_socket(cfg->ifaces[1]);
+    if (t->fds[1] < 0 || get_interface_info(t->fds[0], cfg->ifaces[0], &t->peer) < 0) {
+        close_raw_socket(t->fds[0]);
+        if (t->fds[1] >= 0) close_raw_socket(t->fds[1]);
+        return -1;
+    }
+    int mtu = get_interface_mtu(t->fds[0], cfg->ifaces[0]);
+    *mtu_payload = mtu > EXT_HEADER_SIZE ? mtu - EXT_HEADER_SIZE : MAX_DATA_SIZE;
+    if (*mtu_payload > EXT_MAX_DATA_SIZE) *mtu_payload = EXT_MAX_DATA_SIZE;
+    return 0;
+}
+
+static int run_transfer(const BenchConfig *cfg, const uint8_t *data, size_t size, double loss,
+                        Result *res) {
+    Transfer t = { .data = data, .size = size };
+    int mtu_payload;
+    memset(res, 0, sizeof(*res));
+
+    if (open_link(cfg, loss, &mtu_payload, &t) < 0) return -1;
+    t.payload = cfg->extended ? mtu_payload : MAX_DATA_SIZE;
+    t.ext_type_flags = cfg->ext_type_flags;
+    t.frames = (size + t.payload - 1) / t.payload;
+    t.sent_at = calloc(t.frames + 1, sizeof(long long));
+    t.delivered_at = calloc(t.frames + 1, sizeof(long long));
+    if (!t.sent_at || !t.delivered_at) {
+        perror("calloc failed");
+        free(t.sent_at);
+        free(t.delivered_at);
+        close_raw_socket(t.fds[0]);
+        close_raw_socket(t.fds[1]);
+        return -1;
+    }
+
+    RttEstimator rtt;
+    ArqSender s;
+    rtt_init(&rtt);
+    arq_sender_init(&s, t.fds[0], &t.peer, cfg->mode, cfg->window, 0, &rtt);
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    long long start = get_timestamp_us();
+
+    pthread_t receiver;
+    if (pthread_create(&receiver, NULL, receive_treasure, &t) != 0) {
+        perror("pthread_create failed");
+        res->ok = 0;
+    } else {
+        int sent = send_treasure(&t, &s);
+        atomic_store(&t.sender_done, 1);
+        pthread_join(receiver, NULL);
+        res->ok = sent == 0 && t.intact;
+    }
+
+    res->seconds = (get_timestamp_us() - start) / 1e6;
+    getrusage(RUSAGE_SELF, &after);
+    res->cpu_user = cpu_seconds(&after.ru_utime) - cpu_seconds(&before.ru_utime);
+    res->cpu_sys = cpu_seconds(&after.ru_stime) - cpu_seconds(&before.ru_stime);
+    res->transmissions = s.transmissions;
+    res->retransmissions = s.retransmissions;
+
+    // Per-frame latency: first transmission to in-order delivery
+    if (res->ok && t.frames > 0) {
+        for (size_t i = 0; i < t.frames; i++) {
+            t.delivered_at[i] -= t.sent_at[i];
+        }
+        qsort(t.delivered_at, t.frames, sizeof(long long), compare_ll);
+        res->p50_us = t.delivered_at[t.frames * 50 / 100];
+        res->p99_us = t.delivered_at[t.frames * 99 / 100];
+    }
+
+    free(t.sent_at);
+    free(t.delivered_at);
+    close_raw_socket(t.fds[0]);
+    close_raw_socket(t.fds[1]);
+    return 0;
+}
+
+// "4k,256k,4m"
+static int parse_sizes(char *list, BenchConfig *cfg) {
+    char *save;
+    cfg->size_count = 0;
+    for (char *item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if (cfg->size_count == BENCH_MAX_ENTRIES) return -1;
+        char *end;
+        double value = strtod(item, &end);
+        if (*end == 'k' || *end == 'K') value *= 1024;
+        else if (*end == 'm' || *end == 'M') value *= 1024 * 1024;
+        else if (*end != '\0') return -1;
+        if (value < 0) return -1;
+        cfg->sizes[cfg->size_count++] = (size_t)value;
+    }
+    return cfg->size_count > 0 ? 0 : -1;
+}
+
+// "0,0.01,0.05"
+static int parse_losses(char *list, BenchConfig *cfg) {
+    char *save;
+    cfg->loss_count = 0;
+    for (char *item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if (cfg->loss_count == BENCH_MAX_ENTRIES) return -1;
+        double loss = atof(item);
+        if (loss < 0 || loss >= 1) return -1;
+        cfg->losses[cfg->loss_count++] = loss;
+    }
+    return cfg->loss_count > 0 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m gbn|sr] [-w window] [-x] [-C] [-s sizes] [-l losses] "
+                    "[-L link] [-i iface0,iface1]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig cfg = { .mode = ARQ_SELECTIVE_REPEAT, .window = SR_MAX_WINDOW };
+    char default_sizes[] = "4k,256k,4m";
+    char default_losses[] = "0,0.01,0.05";
+    char *sizes = default_sizes, *losses = default_losses, *ifaces = NULL;
+    const char *link = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:w:xCs:l:L:i:")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "gbn") == 0) {
+                    cfg.mode = ARQ_GO_BACK_N;
+                } else if (strcmp(optarg, "sr") == 0) {
+                    cfg.mode = ARQ_SELECTIVE_REPEAT;
+                } else {
+                    fprintf(stderr, "Unknown mode '%s' (use gbn or sr)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                cfg.window = atoi(optarg);
+                break;
+            case 'x':
+                cfg.extended = 1;
+                break;
+            case 'C':
+                cfg.extended = 1;
+                cfg.ext_type_flags = EXT_TYPE_CRC8;
+                break;
+            case 's':
+                sizes = optarg;
+                break;
+            case 'l':
+                losses = optarg;
+                break;
+            case 'L':
+                link = optarg;
+                break;
+            case 'i':
+                ifaces = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int max_window = (cfg.mode == ARQ_SELECTIVE_REPEAT) ? SR_MAX_WINDOW : GBN_MAX_WINDOW;
+    if (cfg.window < 1 || cfg.window > max_window) {
+        fprintf(stderr, "Window must be between 1 and %d for %s\n",
+                max_window, arq_mode_name(cfg.mode));
+        return 1;
+    }
+    if (parse_sizes(sizes, &cfg) < 0) {
+        fprintf(stderr, "Sizes must be a list like 4k,256k,4m (at most %d)\n", BENCH_MAX_ENTRIES);
+        return 1;
+    }
+    if (parse_losses(losses, &cfg) < 0) {
+        fprintf(stderr, "Loss rates must be a list like 0,0.01 in [0, 1) (at most %d)\n",
+                BENCH_MAX_ENTRIES);
+        return 1;
+    }
+    if (link_config_parse(link, &cfg.link) < 0) {
+        return 1;
+    }
+    if (ifaces) {
+        char *comma = strchr(ifaces, ',');
+        if (!comma) {
+            fprintf(stderr, "Give the veth pair as iface0,iface1\n");
+            return 1;
+        }
+        *comma = '\0';
+        cfg.ifaces[0] = ifaces;
+        cfg.ifaces[1] = comma + 1;
+
+        // A real link loses what it loses; impair it with netem instead
+        for (int i = 0; i < cfg.loss_count; i++) {
+            if (cfg.losses[i] > 0) {
+                fprintf(stderr, "Loss rates need the simulated link (use tc netem on a veth pair)\n");
+                return 1;
+            }
+        }
+    }
+
+    // Synthetic treasure: the largest size, shared by every run
+    size_t largest = 0;
+    for (int i = 0; i < cfg.size_count; i++) {
+        if (cfg.sizes[i] > largest) largest = cfg.sizes[i];
+    }
+    uint8_t *data = malloc(largest + 1);
+    if (!data) {
+        perror("malloc failed");
+        return 1;
+    }
+    unsigned seed = cfg.link.seed;
+    for (size_t i = 0; i < largest; i++) {
+        data[i] = rand_r(&seed);
+    }
+
+    printf("{\"link\": \"%s\", \"mode\": \"%s\", \"window\": %d, \"payload\": \"%s\", "
+           "\"checksum\": \"%s\",\n",
+           cfg.ifaces[0] ? "veth" : "sim", cfg.mode == ARQ_SELECTIVE_REPEAT ? "sr" : "gbn",
+           cfg.window, cfg.extended ? "extended" : "standard",
+           cfg.ext_type_flags & EXT_TYPE_CRC8 ? "crc8" : "xor");
+    printf(" \"results\": [");
+
+    int failed = 0;
+    const char *sep = "";
+    for (int i = 0; i < cfg.size_count; i++) {
+        for (int j = 0; j < cfg.loss_count; j++) {
+            Result res;
+            if (run_transfer(&cfg, data, cfg.sizes[i], cfg.losses[j], &res) < 0) {
+                fprintf(stderr, "Failed to open the link\n");
+                free(data);
+                return 1;
+            }
+            if (!res.ok) failed = 1;
+
+            double goodput = res.seconds > 0 ? cfg.sizes[i] * 8 / res.seconds / 1e6 : 0;
+            printf("%s\n  {\"size\": %zu, \"loss\": %g, \"ok\": %s, \"seconds\": %.6f, "
+                   "\"goodput_mbps\": %.3f, \"transmissions\": %lu, \"retransmissions\": %lu, "
+                   "\"latency_p50_us\": %lld, \"latency_p99_us\": %lld, "
+                   "\"cpu_user_s\": %.6f, \"cpu_sys_s\": %.6f}",
+                   sep, cfg.sizes[i], cfg.losses[j], res.ok ? "true" : "false", res.seconds,
+                   goodput, res.transmissions, res.retransmissions, res.p50_us, res.p99_us,
+                   res.cpu_user, res.cpu_sys);
+            fflush(stdout);
+            sep = ",";
+        }
+    }
+    printf("\n]}\n");
+
+    free(data);
+    return failed;
+}
@@ -0,0 +1,270 @@
+// checksum.c
+#include "checksum.h"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define CRC8_POLY 0x07
+
+// crc8_table[k][b]: CRC of byte b followed by k zero bytes
+static uint8_t crc8_table[8][256];
+
+// Fold the bytes of a 64-bit word into one
+static inline uint8_t fold64(uint64_t x) {
+    x ^= x >> 32;
+    x ^= x >> 16;
+    x ^= x >> 8;
+    return (uint8_t)x;
+}
+
+static uint8_t xor_byte_kernel(const uint8_t *data, size_t len) {
+    uint8_t x = 0;
+    for (size_t i = 0; i < len; i++) {
+        x ^= data[i];
+    }
+    return x;
+}
+
+static uint8_t xor_word_kernel(const uint8_t *data, size_t len) {
+    uint64_t acc = 0;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);  // Unaligned load
+        acc ^= word;
+    }
+    return fold64(acc) ^ xor_byte_kernel(data + i, len - i);
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static uint8_t xor_sse2_kernel(const uint8_t *data, size_t len) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        acc = _mm_xor_si128(acc, _mm_loadu_si128((const __m128i *)(data + i)));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return fold64(lanes[0] ^ lanes[1]) ^ xor_word_kernel(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint8_t xor_avx2_kernel(const uint8_t *data, size_t len) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        acc = _mm256_xor_si256(acc, _mm256_loadu_si256((const __m256i *)(data + i)));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return fold64(lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3]) ^
+           xor_word_kernel(data + i, len - i);
+}
+
+static int cpu_has_sse2(void) { return __builtin_cpu_supports("sse2"); }
+static int cpu_has_avx2(void) { return __builtin_cpu_supports("avx2"); }
+#endif
+
+static int always(void) { return 1; }
+
+typedef struct {
+    const char *name;
+    uint8_t (*fn)(const uint8_t *data, size_t len);
+    int (*supported)(void);
+} XorKernel;
+
+// Fastest first
+static const XorKernel xor_kernels[] = {
+#ifdef HAVE_X86_KERNELS
+    { "avx2", xor_avx2_kernel, cpu_has_avx2 },
+    { "sse2", xor_sse2_kernel, cpu_has_sse2 },
+#endif
+    { "word", xor_word_kernel, always },
+    { "byte", xor_byte_kernel, always },
+};
+
+#define XOR_KERNEL_COUNT (sizeof(xor_kernels) / sizeof(xor_kernels[0]))
+
+static const XorKernel *xor_kernel = &xor_kernels[XOR_KERNEL_COUNT - 2];  // word
+
+// Runs before main: pick the kernel and build the CRC tables, so the hot
+// paths need neither a lock nor an initialised check
+__attribute__((constructor))
+static void checksum_setup(void) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+#endif
+    for (size_t i = 0; i < XOR_KERNEL_COUNT; i++) {
+        if (xor_kernels[i].supported()) {
+            xor_kernel = &xor_kernels[i];
+            break;
+        }
+    }
+
+    for (int b = 0; b < 256; b++) {
+        uint8_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ CRC8_POLY) : (uint8_t)(crc << 1);
+        }
+        crc8_table[0][b] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            crc8_table[k][b] = crc8_table[0][crc8_table[k - 1][b]];
+        }
+    }
+}
+
+uint8_t xor_bytes(const uint8_t *data, size_t len) {
+    return xor_kernel->fn(data, len);
+}
+
+uint8_t crc8_update(uint8_t crc, const uint8_t *data, size_t len) {
+    // Eight independent lookups per step instead of a chain of eight
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        crc = crc8_table[7][crc ^ data[i]] ^ crc8_table[6][data[i + 1]] ^
+              crc8_table[5][data[i + 2]] ^ crc8_table[4][data[i + 3]] ^
+              crc8_table[3][data[i + 4]] ^ crc8_table[2][data[i + 5]] ^
+              crc8_table[1][data[i + 6]] ^ crc8_table[0][data[i + 7]];
+    }
+    for (; i < len; i++) {
+        crc = crc8_table[0][crc ^ data[i]];
+    }
+    return crc;
+}
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);  // Little-endian hosts only, like the rest of the x86 paths
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    return rotl64(acc, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+void xxh64_init(Xxh64State *state, uint64_t seed) {
+    memset(state, 0, sizeof(*state));
+    state->seed = seed;
+    state->v[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+    state->v[1] = seed + XXH_PRIME2;
+    state->v[2] = seed;
+    state->v[3] = seed - XXH_PRIME1;
+}
+
+// Fold full 32-byte stripes into the four lanes; returns the bytes consumed
+static size_t xxh_stripes(uint64_t v[4], const uint8_t *p, size_t len) {
+    const uint8_t *start = p;
+    for (; len >= 32; p += 32, len -= 32) {
+        v[0] = xxh_round(v[0], read64(p));
+        v[1] = xxh_round(v[1], read64(p + 8));
+        v[2] = xxh_round(v[2], read64(p + 16));
+        v[3] = xxh_round(v[3], read64(p + 24));
+    }
+    return p - start;
+}
+
+void xxh64_update(Xxh64State *state, const void *data, size_t len) {
+    const uint8_t *p = data;
+    state->total += len;
+
+    if (state->buffered) {
+        size_t take = 32 - state->buffered < len ? 32 - state->buffered : len;
+        memcpy(state->buf + state->buffered, p, take);
+        state->buffered += take;
+        p += take;
+        len -= take;
+        if (state->buffered < 32) return;
+        xxh_stripes(state->v, state->buf, 32);
+        state->buffered = 0;
+    }
+
+    size_t done = xxh_stripes(state->v, p, len);
+    memcpy(state->buf, p + done, len - done);
+    state->buffered = len - done;
+}
+
+uint64_t xxh64_digest(const Xxh64State *state) {
+    uint64_t h;
+    if (state->total >= 32) {
+        const uint64_t *v = state->v;
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = xxh_merge(h, v[i]);
+        }
+    } else {
+        h = state->seed + XXH_PRIME5;
+    }
+    h += state->total;
+
+    const uint8_t *p = state->buf;
+    size_t len = state->buffered;
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)read32(p) * XXH_PRIME1;
+        h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--) {
+        h ^= *p * XXH_PRIME5;
+        h = rotl64(h, 11) * XXH_PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+    Xxh64State state;
+    xxh64_init(&state, seed);
+    xxh64_update(&state, data, len);
+    return xxh64_digest(&state);
+}
+
+const char *checksum_kernel(void) {
+    return xor_kernel->name;
+}
+
+int checksum_use_kernel(const char *name) {
+    for (size_t i = 0; i < XOR_KERNEL_COUNT; i++) {
+        if (strcmp(xor_kernels[i].name, name) == 0 && xor_kernels[i].supported()) {
+            xor_kernel = &xor_kernels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,36 @@
+// checksum.h
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XOR of every byte: the spec's checksum. Runs on the widest kernel the CPU
+// supports (AVX2, SSE2, or 64-bit words), chosen once at startup.
+uint8_t xor_bytes(const uint8_t *data, size_t len);
+
+// CRC-8 (polynomial 0x07), slicing-by-8. Unlike the XOR it catches an even
+// number of flipped bits in the same bit position. Start with crc = 0.
+uint8_t crc8_update(uint8_t crc, const uint8_t *data, size_t len);
+
+// XXH64: a fast 64-bit hash for whole files, e.g. to check that a partial
+// download still matches its source. Feed it in pieces of any size.
+typedef struct {
+    uint64_t total;
+    uint64_t v[4];
+    uint8_t buf[32];  // Input not yet folded into a full 32-byte stripe
+    size_t buffered;
+    uint64_t seed;
+} Xxh64State;
+
+void     xxh64_init(Xxh64State *state, uint64_t seed);
+void     xxh64_update(Xxh64State *state, const void *data, size_t len);
+uint64_t xxh64_digest(const Xxh64State *state);  // The state can keep growing after
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+// Kernel behind xor_bytes ("avx2", "sse2", "word" or "byte"); selecting an
+// unknown or unsupported one returns -1 and keeps the current kernel
+const char *checksum_kernel(void);
+int         checksum_use_kernel(const char *name);
+
+#endif // CHECKSUM_H
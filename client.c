@@ -1,15 +1,26 @@
 #include "sockets.h"
+#include "arq.h"
+#include "trace.h"
+#include "checksum.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <termios.h>
+#include <poll.h>
 #include <sys/statvfs.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
 #include <errno.h>
 
-#define GRID_SIZE 8
 #define RECEIVED_FILES_DIR "./received"
+#define OBJECTS_DIR RECEIVED_FILES_DIR "/.objects"  // Received files linked by XXH64
+#define CHECKPOINT_BYTES (4u << 20)  // Partial files are checkpointed this often
+#define TRANSFER_IDLE_MS 10000       // Give up on a transfer silent for this long
+#define RESUME_RESEND_MS 300         // Repeat EXT_RESUME until the server answers
+#define MOVE_RETRIES 8               // Transmissions of a move before giving up
+#define MOVE_QUEUE_SIZE 64           // Keys typed ahead while the server is busy
 
 typedef struct {
     int x, y;
@@ -18,6 +29,45 @@ typedef struct {
     char treasure_name[64];
 } GridCell;
 
+// What the client is waiting for; keys typed meanwhile wait in the queue
+typedef enum {
+    CLIENT_IDLE,
+    CLIENT_MOVING,     // A move is in flight until its OK_ACK, ERROR or PKT_SIZE,
+                       // or a path until its EXT_PATH_ACK and any PKT_SIZE it announces
+    CLIENT_RECEIVING   // A treasure is arriving
+} ClientStage;
+
+// Progress of a partial file: received/<name>.part holds the bytes, and
+// received/<name>.ckpt how many of them were written and their XXH64
+typedef struct {
+    uint32_t file_size;
+    uint32_t offset;
+    uint64_t hash;
+} Checkpoint;
+
+// A treasure on its way in, from its PKT_SIZE to its PKT_END_FILE
+typedef struct {
+    ArqReceiver rx;
+    char filename[64];
+    char filepath[128];
+    char partpath[160];
+    PacketType file_type;
+    uint32_t file_size;
+    uint32_t bytes_received;
+    int file_fd;
+    Xxh64State hash;                 // Of everything in the partial file so far
+    uint32_t checkpointed;           // Offset of the last checkpoint
+    uint32_t resume_offset;          // Offset we asked the server for
+    int awaiting_resume;             // EXT_RESUME sent, its ACK not yet seen
+    long long resume_sent_ms;
+    uint64_t content_hash;           // Server's XXH64 of the whole file
+    int have_hash;
+    int from_cache;                  // Claimed the whole file from the object store
+    long long last_frame_ms;
+    unsigned percent_shown;          // On the progress line
+    int finished;                    // End of file seen: rx answers the server's late resends
+} Download;
+
 typedef struct {
     int player_x, player_y;
     GridCell grid[GRID_SIZE][GRID_SIZE];
@@ -25,100 +75,300 @@ typedef struct {
     struct sockaddr_ll server_addr;
     uint8_t seq_num;
     int treasures_found;
-    PacketType pending_move; // Track the pending move
+    uint16_t ext_payload;    // Extended DATA payload agreed with the server (0 = standard)
+    uint8_t ext_check;       // ExtCheck for extended frames: asked for, then agreed
+    uint8_t ext_flags;       // ExtFlags the server granted
+    ClientStage stage;
+    Packet move;             // CLIENT_MOVING: the move or path frame, resent until answered
+    int move_tries;
+    int move_suspended;      // A transfer started before the path's answer came
+    int file_follows;        // The path's answer came; its treasure's PKT_SIZE has not
+    long long move_sent_us;  // First transmission, for the RTT sample
+    long long move_deadline_us;
+    RttEstimator rtt;        // Sets the move retransmission timeout
+    PacketType queue[MOVE_QUEUE_SIZE];
+    int queue_head, queue_len;
+    Download download;       // CLIENT_RECEIVING
+    int running;
+    int input_closed;        // End of input: quit once the queue is done
 } ClientState;
 
 // Function prototypes
 void init_client(ClientState *client);
 void display_grid(const ClientState *client);
 int send_movement(ClientState *client, PacketType move_type);
-void process_server_packet(ClientState *client, const Packet *pkt);
-int receive_file_transfer(ClientState *client, const Packet *initial_pkt);
+int send_path(ClientState *client);
+void handle_move_timeout(ClientState *client);
+void process_server_packet(ClientState *client, const Packet *pkt, const struct sockaddr_ll *from);
+int start_download(ClientState *client, const Packet *initial_pkt);
+void process_download_frame(ClientState *client, const Frame *pkt);
+void handle_download_timeout(ClientState *client);
+void interrupt_download(ClientState *client);
 void handle_treasure_file(const char *filename, PacketType file_type);
-char get_user_input(void);
+int get_user_input(void);
 void setup_terminal(void);
 void restore_terminal(void);
 int check_disk_space(const char *path, size_t required_space);
 void create_received_dir(void);
+int negotiate_extension(ClientState *client, const char *iface, int extended);
 
 static struct termios old_termios;
 
+static void resend_move(ClientState *client);
+
+// Moves are queued as keys arrive and go out one at a time
+static void handle_key(ClientState *client, int key) {
+    PacketType move_type;
+
+    switch (key) {
+        case 'q': case 'Q': client->running = 0; return;
+        case 'w': case 'W': move_type = PKT_MOVE_UP; break;
+        case 'a': case 'A': move_type = PKT_MOVE_LEFT; break;
+        case 's': case 'S': move_type = PKT_MOVE_DOWN; break;
+        case 'd': case 'D': move_type = PKT_MOVE_RIGHT; break;
+        default:
+            printf("Invalid input. Use WASD or arrow keys to move, Q to quit.\n");
+            return;
+    }
+
+    int tail = (client->queue_head + client->queue_len) % MOVE_QUEUE_SIZE;
+    client->queue[tail] = move_type;
+    client->queue_len++;
+}
+
+// A frame of the completed transfer, sent again: its sequence number is
+// behind what the transfer's receiver expects next. Move answers carry the
+// move's own sequence number, so only transfer frame types count.
+static int stale_transfer_frame(const ClientState *client, const Frame *frame) {
+    if (!client->download.finished) return 0;
+
+    switch (frame->type) {
+        case PKT_SIZE:
+        case PKT_DATA:
+        case PKT_END_FILE:
+        case PKT_TEXT_ACK:
+        case PKT_VIDEO_ACK:
+        case PKT_IMAGE_ACK:
+            break;
+        case PKT_EXTENSION:
+            if (frame->size > 0 && frame->data[0] == EXT_RESUME_ACK) break;
+            return 0;
+        default:
+            return 0;
+    }
+    int behind = seq_diff(frame->seq, client->download.rx.expected);
+    return behind < 0 && behind >= -SEQ_MODULO / 2;
+}
+
+// Frames that are already waiting; the transfer's go through its receiver
+static void handle_socket(ClientState *client) {
+    while (client->running) {
+        if (client->stage == CLIENT_RECEIVING) {
+            Frame frame;
+            if (arq_receive(&client->download.rx, client->socket_fd, &frame,
+                            &client->server_addr, 0) <= 0) {
+                return;
+            }
+            process_download_frame(client, &frame);
+            continue;
+        }
+
+        union {
+            PacketRaw raw;
+            uint8_t bytes[MAX_FRAME_SIZE];  // Extended frames of the last transfer
+        } buf;
+        struct sockaddr_ll from;
+        ssize_t received = socket_recv_raw(client->socket_fd, &buf, sizeof(buf), &from,
+                                           MSG_DONTWAIT);
+        if (received <= 0) return;
+
+        // Our final ACK was lost and the server resends: answer for the
+        // finished transfer, and never take its PKT_SIZE for a new one
+        Frame frame;
+        if (decode_frame(buf.bytes, received, &frame) && stale_transfer_frame(client, &frame)) {
+            send_ack_seq(client->socket_fd, &client->server_addr, PKT_ACK,
+                         seq_add(client->download.rx.expected, -1));
+            continue;
+        }
+        if (!packet_length_ok(&buf.raw, received)) continue;
+
+        Packet pkt;
+        unpack_packet(&buf.raw, &pkt);
+        if (validate_packet(&pkt)) process_server_packet(client, &pkt, &from);
+    }
+}
+
+// Absolute CLOCK_MONOTONIC time of the next retransmission or give-up (0 = none)
+static long long client_deadline_us(const ClientState *client) {
+    const Download *d = &client->download;
+
+    switch (client->stage) {
+        case CLIENT_MOVING:
+            return client->move_deadline_us;
+        case CLIENT_RECEIVING:
+            if (d->awaiting_resume) return (d->resume_sent_ms + RESUME_RESEND_MS) * 1000;
+            return (d->last_frame_ms + TRANSFER_IDLE_MS) * 1000;
+        default:
+            return 0;
+    }
+}
+
+static int arm_timer(int timer_fd, long long deadline_us) {
+    struct itimerspec its = {0};  // All zero disarms the timer
+    if (deadline_us > 0) {
+        its.it_value.tv_sec = deadline_us / 1000000;
+        its.it_value.tv_nsec = (deadline_us % 1000000) * 1000;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        return -1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <interface>\n", argv[0]);
+    unsigned socket_flags = 0;
+    int extension = 0;
+    uint8_t ext_check = EXT_CHECK_XOR;
+    const char *trace_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "rxCeT:")) != -1) {
+        switch (opt) {
+            case 'r':
+                socket_flags |= SOCKET_RX_RING | SOCKET_TX_RING;
+                break;
+            case 'x':
+                extension = 1;
+                break;
+            case 'C':
+                extension = 1;
+                ext_check = EXT_CHECK_CRC8;
+                break;
+            case 'e':
+                socket_flags |= SOCKET_ETHERTYPE;
+                break;
+            case 'T':
+                trace_path = optarg;
+                socket_flags |= SOCKET_TIMESTAMPS;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r] [-x] [-C] [-e] [-T trace_file] <interface>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-r] [-x] [-C] [-e] [-T trace_file] <interface>\n", argv[0]);
         return 1;
     }
+    const char *iface = argv[optind];
 
     ClientState client = {0};
-    
+    if (trace_path && trace_start(TRACE_DEFAULT_EVENTS) < 0) return 1;
+
     // Create received files directory
     create_received_dir();
-    
+
     // Create raw socket
-    client.socket_fd = create_raw_socket(argv[1]);
+    client.socket_fd = create_raw_socket_ex(iface, socket_flags);
     if (client.socket_fd < 0) {
         fprintf(stderr, "Failed to create raw socket\n");
         return 1;
     }
 
     // Get interface info
-    if (get_interface_info(client.socket_fd, argv[1], &client.server_addr) < 0) {
-        close(client.socket_fd);
+    if (get_interface_info(client.socket_fd, iface, &client.server_addr) < 0) {
+        close_raw_socket(client.socket_fd);
+        return 1;
+    }
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timer_fd < 0) {
+        perror("timerfd_create");
+        close_raw_socket(client.socket_fd);
         return 1;
     }
 
     // Initialize client
     init_client(&client);
+    client.ext_check = ext_check;
+    negotiate_extension(&client, iface, extension);
     setup_terminal();
-    
+
     printf("=== TREASURE HUNT CLIENT ===\n");
-    printf("Interface: %s\n", argv[1]);
+    printf("Interface: %s\n", iface);
     printf("Use WASD keys or arrow keys to move (W/Up=Up, A/Left=Left, S/Down=Down, D/Right=Right), Q to quit\n\n");
-    
+
     display_grid(&client);
 
-    // Main client loop
-    char input;
-    while ((input = get_user_input()) != 'q' && input != 'Q') {
-        PacketType move_type;
-        int valid_move = 1;
-        
-        switch (input) {
-            case 'w': case 'W': move_type = PKT_MOVE_UP; break;
-            case 'a': case 'A': move_type = PKT_MOVE_LEFT; break;
-            case 's': case 'S': move_type = PKT_MOVE_DOWN; break;
-            case 'd': case 'D': move_type = PKT_MOVE_RIGHT; break;
-            default: 
-                valid_move = 0;
-                printf("Invalid input. Use WASD or arrow keys to move, Q to quit.\n");
-                break;
+    // One loop serves keys, frames and retransmission deadlines, so typing
+    // never waits for the network and a lost frame never hangs the game
+    while (client.running) {
+        // Queued moves go out as soon as nothing else is in flight: all of
+        // them in one path when the server takes paths, else the next one
+        if (client.stage == CLIENT_IDLE && client.queue_len > 0) {
+            if (client.ext_flags & EXT_FLAG_PATH) {
+                send_path(&client);
+            } else {
+                PacketType move_type = client.queue[client.queue_head];
+                client.queue_head = (client.queue_head + 1) % MOVE_QUEUE_SIZE;
+                client.queue_len--;
+                send_movement(&client, move_type);
+            }
+            continue;
         }
-        
-        if (valid_move) {
-            if (send_movement(&client, move_type) == 0) {
-                // Wait for server response using direct recvfrom with proper unpacking
-                PacketRaw raw_response;
-                struct sockaddr_ll server_addr;
-                socklen_t addr_len = sizeof(server_addr);
-                
-                ssize_t received = recvfrom(client.socket_fd, &raw_response, sizeof(PacketRaw), 0,
-                                          (struct sockaddr *)&server_addr, &addr_len);
-                
-                if (received == sizeof(PacketRaw)) {
-                    Packet response;
-                    unpack_packet(&raw_response, &response);
-                    
-                    if (validate_packet(&response)) {
-                        process_server_packet(&client, &response);
-                        display_grid(&client);
-                    }
-                }
+        if (client.input_closed && client.stage == CLIENT_IDLE) break;
+
+        if (arm_timer(timer_fd, client_deadline_us(&client)) < 0) break;
+
+        // A full queue leaves further keys in the terminal until there is room
+        struct pollfd fds[3] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = client.socket_fd, .events = POLLIN },
+            { .fd = timer_fd, .events = POLLIN }
+        };
+        if (client.input_closed || client.queue_len == MOVE_QUEUE_SIZE) fds[0].fd = -1;
+
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) handle_socket(&client);
+
+        if (fds[2].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                perror("timerfd read");
+            }
+            long long now = get_timestamp_us();
+            if (client.stage == CLIENT_MOVING && now >= client.move_deadline_us) {
+                handle_move_timeout(&client);
+            } else if (client.stage == CLIENT_RECEIVING) {
+                handle_download_timeout(&client);
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            int key = get_user_input();
+            if (key < 0) {
+                client.input_closed = 1;
+            } else {
+                handle_key(&client, key);
             }
         }
     }
 
+    if (client.stage == CLIENT_RECEIVING) interrupt_download(&client);
     restore_terminal();
-    close(client.socket_fd);
+    close(timer_fd);
+    close_raw_socket(client.socket_fd);
+    if (trace_path) {
+        trace_write_json(trace_path);
+        trace_stop();
+    }
     printf("Game ended. Treasures found: %d\n", client.treasures_found);
     return 0;
 }
@@ -129,6 +379,10 @@ void init_client(ClientState *client) {
     client->player_y = 0;
     client->seq_num = 0;
     client->treasures_found = 0;
+    client->stage = CLIENT_IDLE;
+    client->download.file_fd = -1;
+    client->running = 1;
+    rtt_init(&client->rtt);
     
     // Initialize grid
     for (int y = 0; y < GRID_SIZE; y++) {
@@ -190,32 +444,327 @@ void display_grid(const ClientState *client) {
     fflush(stdout);
 }
 
+// Send a move or a path and wait for its answer; the timer resends it meanwhile
+static int send_request(ClientState *client, const Packet *request) {
+    client->move = *request;
+    client->move.start_marker = START_MARKER;
+    client->move.seq = client->seq_num;
+    client->seq_num = seq_add(client->seq_num, 1);
+    client->stage = CLIENT_MOVING;
+    client->move_tries = 1;
+    client->move_suspended = 0;
+    client->file_follows = 0;
+    client->move_sent_us = get_timestamp_us();
+    client->move_deadline_us = client->move_sent_us + rtt_timeout_us(&client->rtt);
+
+    return send_frame(client->socket_fd, &client->move, &client->server_addr);
+}
+
 int send_movement(ClientState *client, PacketType move_type) {
-    // Store the intended movement for later confirmation
-    client->pending_move = move_type;
-    
-    Packet move_pkt = {
+    Packet move = { .size = 0, .type = move_type };
+    return send_request(client, &move);
+}
+
+// Everything queued, up to a frame's worth, for one round trip
+int send_path(ClientState *client) {
+    Packet path = { .size = 1, .type = PKT_EXTENSION, .data = { EXT_PATH } };
+    while (client->queue_len > 0 && path.size - 1 < EXT_PATH_MAX_MOVES) {
+        path.data[path.size++] = client->queue[client->queue_head];
+        client->queue_head = (client->queue_head + 1) % MOVE_QUEUE_SIZE;
+        client->queue_len--;
+    }
+    return send_request(client, &path);
+}
+
+// Moves a path did not get to go back to the front of the queue; if the
+// queue filled up meanwhile, the newest keys make room
+static void requeue_moves(ClientState *client, const uint8_t *moves, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+        if (client->queue_len == MOVE_QUEUE_SIZE) client->queue_len--;
+        client->queue_head = (client->queue_head + MOVE_QUEUE_SIZE - 1) % MOVE_QUEUE_SIZE;
+        client->queue[client->queue_head] = moves[i];
+        client->queue_len++;
+    }
+}
+
+// The move or its answer was lost: the same frame goes again, and the
+// server answers a repeated sequence number without moving twice
+void handle_move_timeout(ClientState *client) {
+    if (client->move_tries >= MOVE_RETRIES) {
+        if (client->file_follows) {
+            printf("\nThe treasure's file never came; step on it again to fetch it\n");
+        } else {
+            printf("\nNo answer from the server, move dropped\n");
+        }
+        client->stage = CLIENT_IDLE;
+        client->queue_len = 0;
+        display_grid(client);
+        return;
+    }
+
+    rtt_backoff(&client->rtt);
+    resend_move(client);
+}
+
+static void resend_move(ClientState *client) {
+    client->move_tries++;
+    client->move_deadline_us = get_timestamp_us() + rtt_timeout_us(&client->rtt);
+    send_frame(client->socket_fd, &client->move, &client->server_addr);
+}
+
+// The move in flight got its answer
+static void finish_move(ClientState *client, const struct sockaddr_ll *from) {
+    // Karn's rule: a resent move gives an ambiguous sample
+    if (client->move_tries == 1) {
+        rtt_sample(&client->rtt, get_timestamp_us() - client->move_sent_us);
+    }
+    // Talk to the server directly once it has answered
+    client->server_addr = *from;
+    client->stage = CLIENT_IDLE;
+}
+
+// Ask for resumable transfers and, when `extended`, for extended DATA frames
+// sized to our MTU, checked with the ExtCheck in client->ext_check. A NACK
+// (a server without the extension) or no answer at all leaves the client on
+// standard frames without resume; a server that ignores data[3] on the XOR.
+int negotiate_extension(ClientState *client, const char *iface, int extended) {
+    uint16_t offer = 0;
+    int mtu = extended ? get_interface_mtu(client->socket_fd, iface) : 0;
+    if (mtu > EXT_HEADER_SIZE + MAX_DATA_SIZE) {
+        offer = mtu - EXT_HEADER_SIZE;
+        if (offer > EXT_MAX_DATA_SIZE) offer = EXT_MAX_DATA_SIZE;
+    }
+
+    for (int attempt = 0; attempt < 3; attempt++) {
+        Packet hello = {
+            .start_marker = START_MARKER,
+            .size = 5,
+            .seq = client->seq_num,
+            .type = PKT_EXTENSION,
+            .data = { EXT_HELLO, offer >> 8, offer & 0xFF, client->ext_check,
+                      EXT_FLAG_RESUME | EXT_FLAG_HASH | EXT_FLAG_PATH }
+        };
+        if (send_frame(client->socket_fd, &hello, &client->server_addr) < 0) return -1;
+
+        Packet reply;
+        struct sockaddr_ll from;
+        long long deadline = get_timestamp_ms() + 300;
+        while (receive_frame(client->socket_fd, &reply, &from,
+                             (int)(deadline - get_timestamp_ms())) > 0) {
+            if (reply.type == PKT_NACK) {
+                client->seq_num = seq_add(client->seq_num, 1);
+                printf("Server does not support extensions\n");
+                return -1;
+            }
+            if (reply.type == PKT_EXTENSION && reply.size >= 3 && reply.data[0] == EXT_HELLO_ACK) {
+                client->server_addr = from;
+                client->seq_num = seq_add(client->seq_num, 1);
+                client->ext_payload = (reply.data[1] << 8) | reply.data[2];
+                client->ext_check = reply.size >= 4 ? reply.data[3] : EXT_CHECK_XOR;
+                client->ext_flags = reply.size >= 5 ? reply.data[4] : 0;
+                if (extended) {
+                    printf("Large payload extension: %d bytes per frame, %s checksum\n",
+                           client->ext_payload ? client->ext_payload : MAX_DATA_SIZE,
+                           client->ext_check == EXT_CHECK_CRC8 ? "CRC-8" : "XOR");
+                }
+                if (client->ext_flags & EXT_FLAG_RESUME) {
+                    printf("Interrupted transfers resume where they stopped\n");
+                }
+                if ((client->ext_flags & (EXT_FLAG_RESUME | EXT_FLAG_HASH)) ==
+                    (EXT_FLAG_RESUME | EXT_FLAG_HASH)) {
+                    printf("Treasures already received are not downloaded again\n");
+                }
+                return 0;
+            }
+        }
+    }
+    printf("No answer to extension offer, using standard frames\n");
+    return -1;
+}
+
+static int load_checkpoint(const char *filepath, Checkpoint *ckpt) {
+    char path[160];
+    snprintf(path, sizeof(path), "%s.ckpt", filepath);
+
+    FILE *in = fopen(path, "r");
+    if (!in) return -1;
+    unsigned long long hash;
+    int fields = fscanf(in, "%u %u %llx", &ckpt->file_size, &ckpt->offset, &hash);
+    fclose(in);
+    ckpt->hash = hash;
+    return fields == 3 ? 0 : -1;
+}
+
+// Replace the checkpoint atomically, so a crash leaves the old one or the new
+static int save_checkpoint(const char *filepath, const Checkpoint *ckpt) {
+    char path[160], tmp[168];
+    snprintf(path, sizeof(path), "%s.ckpt", filepath);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *out = fopen(tmp, "w");
+    if (!out) {
+        perror("fopen checkpoint failed");
+        return -1;
+    }
+    fprintf(out, "%u %u %016llx\n", ckpt->file_size, ckpt->offset,
+            (unsigned long long)ckpt->hash);
+    if (fclose(out) != 0 || rename(tmp, path) < 0) {
+        perror("write checkpoint failed");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Feed the first `len` bytes of a file to `hash`; returns how many were read
+static uint32_t hash_prefix(int fd, uint32_t len, Xxh64State *hash) {
+    uint8_t buf[1 << 16];
+    uint32_t done = 0;
+    while (done < len) {
+        size_t want = len - done < sizeof(buf) ? len - done : sizeof(buf);
+        ssize_t got = pread(fd, buf, want, done);
+        if (got <= 0) break;
+        xxh64_update(hash, buf, got);
+        done += got;
+    }
+    return done;
+}
+
+// Bytes of the partial file that can be kept: the checkpointed prefix, if
+// the file still holds exactly those bytes. Leaves their hash in `hash`.
+static uint32_t resume_point(const char *filepath, int part_fd, uint32_t file_size,
+                             Xxh64State *hash) {
+    Checkpoint ckpt;
+    xxh64_init(hash, 0);
+    if (load_checkpoint(filepath, &ckpt) < 0 || ckpt.file_size != file_size ||
+        ckpt.offset > file_size) {
+        return 0;
+    }
+
+    uint32_t done = hash_prefix(part_fd, ckpt.offset, hash);
+    if (done != ckpt.offset || xxh64_digest(hash) != ckpt.hash) {
+        xxh64_init(hash, 0);
+        return 0;
+    }
+    return ckpt.offset;
+}
+
+static void object_path(char *path, size_t len, uint64_t content_hash) {
+    snprintf(path, len, "%s/%016llx", OBJECTS_DIR, (unsigned long long)content_hash);
+}
+
+// Whether a file with this content was received before. The object is the
+// same inode as the file it was received as, which may have been edited
+// since, so its bytes are hashed again; leaves that hash in `hash`.
+static int lookup_object(uint64_t content_hash, uint32_t file_size, Xxh64State *hash) {
+    char path[64];
+    object_path(path, sizeof(path), content_hash);
+    xxh64_init(hash, 0);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    int found = fstat(fd, &st) == 0 && st.st_size == file_size &&
+                hash_prefix(fd, file_size, hash) == file_size &&
+                xxh64_digest(hash) == content_hash;
+    close(fd);
+
+    if (!found) {
+        xxh64_init(hash, 0);
+        return -1;
+    }
+    return 0;
+}
+
+// Link a verified file into the object store, replacing a stale object
+static void store_object(const char *filepath, uint64_t content_hash) {
+    char path[64];
+    object_path(path, sizeof(path), content_hash);
+    unlink(path);
+    if (link(filepath, path) < 0) perror("link into object store failed");
+}
+
+// Tell the server what we hold; repeated until its EXT_RESUME_ACK arrives
+static void send_resume(ClientState *client, uint32_t offset, uint64_t hash) {
+    Packet resume = {
         .start_marker = START_MARKER,
-        .size = 0,
-        .seq = client->seq_num++,
-        .type = move_type
+        .size = EXT_RESUME_SIZE,
+        .seq = client->seq_num,
+        .type = PKT_EXTENSION,
+        .data = { EXT_RESUME }
     };
-    move_pkt.checksum = calculate_crc(&move_pkt);
-    
-    // Pack the packet for transmission
-    PacketRaw raw_pkt;
-    pack_packet(&move_pkt, &raw_pkt);
-    
-    // Send the packed packet
-    ssize_t sent = sendto(client->socket_fd, &raw_pkt, sizeof(PacketRaw), 0,
-                         (struct sockaddr *)&client->server_addr, sizeof(client->server_addr));
-    
-    return (sent == sizeof(PacketRaw)) ? 0 : -1;
+    uint32_t net_offset = htonl(offset);
+    memcpy(resume.data + 1, &net_offset, sizeof(net_offset));
+    for (int i = 0; i < 8; i++) {
+        resume.data[5 + i] = hash >> (56 - 8 * i);
+    }
+    send_frame(client->socket_fd, &resume, &client->server_addr);
 }
 
-void process_server_packet(ClientState *client, const Packet *pkt) {
+// Positions after each move of the path in flight. Moves the server did not
+// apply wait in the queue for the end of the transfer the last one started.
+// Returns 1 when that transfer's PKT_SIZE is still to come.
+static int apply_path_answer(ClientState *client, const Packet *pkt) {
+    int sent = client->move.size - 1;
+    int applied = pkt->data[1] & ~PATH_FILE_FOLLOWS;
+    if (applied > sent || pkt->size < 2 + applied) applied = 0;
+
+    for (int i = 0; i < applied; i++) {
+        uint8_t position = pkt->data[2 + i];
+        if (position == PATH_REFUSED) {
+            printf("Invalid move - out of bounds!\n");
+            continue;
+        }
+        client->player_x = position >> 4;
+        client->player_y = position & 0x0F;
+        client->grid[client->player_y][client->player_x].visited = 1;
+        printf("Move successful! New position: (%d,%d)\n", client->player_x, client->player_y);
+    }
+    requeue_moves(client, client->move.data + 1 + applied, sent - applied);
+    return (pkt->data[1] & PATH_FILE_FOLLOWS) && !client->move_suspended;
+}
+
+void process_server_packet(ClientState *client, const Packet *pkt, const struct sockaddr_ll *from) {
+    // A transfer starts whatever we are waiting for. It answers a single move;
+    // a path's own answer comes first, or, if that was lost, after the file.
+    if (pkt->type == PKT_SIZE && client->stage != CLIENT_RECEIVING) {
+        if (client->stage == CLIENT_MOVING && client->file_follows) {
+            client->file_follows = 0;
+            client->stage = CLIENT_IDLE;
+        } else if (client->stage == CLIENT_MOVING && client->move.type == PKT_EXTENSION) {
+            client->move_suspended = 1;
+        } else if (client->stage == CLIENT_MOVING) {
+            finish_move(client, from);
+        }
+    } else {
+        // Only the move in flight is answered, under its sequence number;
+        // anything else is a late duplicate
+        if (pkt->type == PKT_SIZE || client->stage != CLIENT_MOVING ||
+            pkt->seq != client->move.seq) {
+            return;
+        }
+    }
+
     switch (pkt->type) {
+        case PKT_EXTENSION:
+            if (client->move.type != PKT_EXTENSION || pkt->size < 2 ||
+                pkt->data[0] != EXT_PATH_ACK || client->file_follows) {
+                return;
+            }
+            finish_move(client, from);
+            if (apply_path_answer(client, pkt)) {
+                // The path ended on a treasure: wait for its file, giving
+                // up after the usual retries if the server never sends it
+                client->stage = CLIENT_MOVING;
+                client->file_follows = 1;
+                client->move_tries = 1;
+                client->move_deadline_us = get_timestamp_us() + rtt_timeout_us(&client->rtt);
+            }
+            client->move_suspended = 0;
+            break;
+
         case PKT_OK_ACK:
+            finish_move(client, from);
             // Regular movement was successful, update client position from server data
             if (pkt->size == 2) {
                 client->player_x = pkt->data[0];
@@ -225,8 +774,9 @@ void process_server_packet(ClientState *client, const Packet *pkt) {
             client->grid[client->player_y][client->player_x].visited = 1;
             printf("Move successful! New position: (%d,%d)\n", client->player_x, client->player_y);
             break;
-            
+
         case PKT_ERROR:
+            finish_move(client, from);
             if (pkt->size > 0) {
                 if (pkt->data[0] == ERR_NO_PERMISSION) {
                     printf("Invalid move - out of bounds!\n");
@@ -235,7 +785,7 @@ void process_server_packet(ClientState *client, const Packet *pkt) {
                 }
             }
             break;
-            
+
         case PKT_SIZE:
             // File transfer starting - this means move was successful AND treasure found
             // The PKT_SIZE packet now contains the new position.
@@ -246,101 +796,252 @@ void process_server_packet(ClientState *client, const Packet *pkt) {
 
             // Mark new position as visited
             client->grid[client->player_y][client->player_x].visited = 1;
-            
-            printf("Move successful! Treasure discovered at (%d,%d)! Receiving file...\n", 
+
+            printf("Move successful! Treasure discovered at (%d,%d)! Receiving file...\n",
                    client->player_x, client->player_y);
-            receive_file_transfer(client, pkt);
-            break;
-            
+            start_download(client, pkt);
+            return;  // The grid is shown again once the file is in
+
         default:
             printf("Received unknown packet type: %d\n", pkt->type);
-            break;
+            return;
     }
+    display_grid(client);
 }
 
-int receive_file_transfer(ClientState *client, const Packet *initial_pkt) {
-    char filename[64] = {0};
-    char filepath[128] = {0};
-    PacketType file_type = PKT_TEXT_ACK;
-    uint32_t file_size = 0;
-    uint32_t bytes_received = 0;
-    FILE *file = NULL;
-    
+// The size frame opens a transfer; the rest arrives through the receiver
+int start_download(ClientState *client, const Packet *initial_pkt) {
+    Download *d = &client->download;
+    memset(d, 0, sizeof(*d));
+    d->file_fd = -1;
+    d->file_type = PKT_TEXT_ACK;
+
     // The first packet (PKT_SIZE) is passed in, process it first.
     if (initial_pkt->type == PKT_SIZE && initial_pkt->size >= sizeof(uint32_t)) {
-        memcpy(&file_size, initial_pkt->data, sizeof(uint32_t));
-        file_size = ntohl(file_size);
-        printf("File size: %u bytes\n", file_size);
-        
+        memcpy(&d->file_size, initial_pkt->data, sizeof(uint32_t));
+        d->file_size = ntohl(d->file_size);
+        printf("File size: %u bytes\n", d->file_size);
+
+        if ((client->ext_flags & EXT_FLAG_HASH) && initial_pkt->size >= SIZE_HASH_SIZE) {
+            for (int i = 0; i < 8; i++) {
+                d->content_hash = (d->content_hash << 8) | initial_pkt->data[6 + i];
+            }
+            d->have_hash = 1;
+        }
+
         // Check disk space
-        if (!check_disk_space(RECEIVED_FILES_DIR, file_size)) {
+        if (!check_disk_space(RECEIVED_FILES_DIR, d->file_size)) {
             printf("Error: Insufficient disk space!\n");
             return -1;
         }
     } else {
-        fprintf(stderr, "Error: receive_file_transfer started with invalid packet.\n");
+        fprintf(stderr, "Error: start_download called with invalid packet.\n");
         return -1;
     }
 
-    // Receive subsequent packets until end of file using proper stop-and-wait protocol
-    Packet pkt;
-    while (1) {
-        ssize_t received = receive_packet(client->socket_fd, &pkt, &client->server_addr);
-        if (received <= 0) continue;
-        
-        switch (pkt.type) {
-            case PKT_TEXT_ACK:
-            case PKT_VIDEO_ACK:
-            case PKT_IMAGE_ACK:
-                // Filename packet
-                file_type = pkt.type;
-                strncpy(filename, (char*)pkt.data, pkt.size);
-                filename[pkt.size] = '\0';
-                snprintf(filepath, sizeof(filepath), "%s/%s", RECEIVED_FILES_DIR, filename);
-                
-                file = fopen(filepath, "wb");
-                if (!file) {
-                    printf("Error: Could not create file %s\n", filepath);
-                    return -1;
-                }
-                printf("Receiving: %s\n", filename);
+    // Acknowledge the size frame and expect the next sequence number; frames
+    // that arrive early wait in the receiver's reorder buffer until the gap is filled
+    arq_receiver_init(&d->rx, initial_pkt->seq);
+    send_ack_seq(client->socket_fd, &client->server_addr, PKT_ACK, initial_pkt->seq);
+    d->last_frame_ms = get_timestamp_ms();
+    client->stage = CLIENT_RECEIVING;
+    return 0;
+}
+
+static void end_download(ClientState *client) {
+    Download *d = &client->download;
+    if (d->file_fd >= 0) close(d->file_fd);
+    d->file_fd = -1;
+    client->stage = CLIENT_IDLE;
+    display_grid(client);
+
+    // The server ignored the path while sending; now it gets the answer,
+    // which announces the file just received
+    if (client->move_suspended) {
+        client->stage = CLIENT_MOVING;
+        resend_move(client);
+    }
+}
+
+// The server gave up or we quit: keep what we have for the next attempt
+void interrupt_download(ClientState *client) {
+    Download *d = &client->download;
+    if (d->file_fd >= 0) {
+        Checkpoint ckpt = { d->file_size, d->bytes_received, xxh64_digest(&d->hash) };
+        save_checkpoint(d->filepath, &ckpt);
+    }
+    printf("\nTransfer interrupted at %u/%u bytes; step on the treasure again to resume\n",
+           d->bytes_received, d->file_size);
+    end_download(client);
+}
+
+void handle_download_timeout(ClientState *client) {
+    Download *d = &client->download;
+    long long now = get_timestamp_ms();
+
+    if (now - d->last_frame_ms >= TRANSFER_IDLE_MS) {
+        interrupt_download(client);
+    } else if (d->awaiting_resume && now - d->resume_sent_ms >= RESUME_RESEND_MS) {
+        send_resume(client, d->resume_offset, xxh64_digest(&d->hash));
+        d->resume_sent_ms = now;
+    }
+}
+
+// One in-order frame of the transfer
+void process_download_frame(ClientState *client, const Frame *frame) {
+    Download *d = &client->download;
+    Frame pkt = *frame;
+    d->last_frame_ms = get_timestamp_ms();
+
+    switch (pkt.type) {
+        case PKT_TEXT_ACK:
+        case PKT_VIDEO_ACK:
+        case PKT_IMAGE_ACK:
+            // Filename packet
+            d->file_type = pkt.type;
+            if (pkt.size >= sizeof(d->filename)) pkt.size = sizeof(d->filename) - 1;
+            strncpy(d->filename, (char*)pkt.data, pkt.size);
+            d->filename[pkt.size] = '\0';
+            snprintf(d->filepath, sizeof(d->filepath), "%s/%s", RECEIVED_FILES_DIR, d->filename);
+            snprintf(d->partpath, sizeof(d->partpath), "%s.part", d->filepath);
+
+            // The file is built under .part and renamed once complete
+            d->file_fd = open(d->partpath, O_RDWR | O_CREAT, 0644);
+            if (d->file_fd < 0) {
+                printf("Error: Could not create file %s\n", d->partpath);
+                end_download(client);
+                return;
+            }
+            printf("Receiving: %s\n", d->filename);
+
+            xxh64_init(&d->hash, 0);
+            d->from_cache = d->have_hash && (client->ext_flags & EXT_FLAG_RESUME) &&
+                            lookup_object(d->content_hash, d->file_size, &d->hash) == 0;
+            if (d->from_cache) {
+                // Claiming every byte leaves the server nothing but the end of file
+                d->resume_offset = d->file_size;
+                send_resume(client, d->resume_offset, d->content_hash);
+                d->awaiting_resume = 1;
+            } else if (client->ext_flags & EXT_FLAG_RESUME) {
+                // The server waits to hear how much we already have
+                d->resume_offset = resume_point(d->filepath, d->file_fd, d->file_size, &d->hash);
+                send_resume(client, d->resume_offset, xxh64_digest(&d->hash));
+                d->awaiting_resume = 1;
+            } else if (ftruncate(d->file_fd, 0) < 0) {
+                perror("ftruncate failed");
+            }
+            d->resume_sent_ms = get_timestamp_ms();
+            break;
+
+        case PKT_EXTENSION: {
+            if (!d->awaiting_resume || pkt.size < EXT_RESUME_ACK_SIZE ||
+                pkt.data[0] != EXT_RESUME_ACK) {
                 break;
-                
-            case PKT_DATA:
-                // File data packet
-                if (file && pkt.size > 0) {
-                    fwrite(pkt.data, 1, pkt.size, file);
-                    bytes_received += pkt.size;
-                    printf("Received %u/%u bytes\r", bytes_received, file_size);
+            }
+            d->awaiting_resume = 0;
+
+            // Data starts where we asked, or from scratch
+            uint32_t offset;
+            memcpy(&offset, pkt.data + 1, sizeof(offset));
+            offset = ntohl(offset);
+            if (offset != d->resume_offset) {
+                xxh64_init(&d->hash, 0);
+                offset = 0;
+                d->from_cache = 0;
+            }
+            if (!d->from_cache && ftruncate(d->file_fd, offset) < 0) {
+                perror("ftruncate failed");
+            }
+            d->bytes_received = d->checkpointed = offset;
+            if (d->from_cache) {
+                printf("Already received, using the stored copy\n");
+            } else if (offset > 0) {
+                printf("Resuming at %u/%u bytes\n", offset, d->file_size);
+            }
+            break;
+        }
+
+        case PKT_DATA:
+            // File data packet
+            if (d->file_fd >= 0 && pkt.size > 0) {
+                // Each frame goes to its own offset in the file
+                long long start_ns = trace_on() ? trace_now_ns() : 0;
+                if (pwrite(d->file_fd, pkt.data, pkt.size, d->bytes_received) != pkt.size) {
+                    perror("pwrite failed");
+                    end_download(client);
+                    return;
+                }
+                if (start_ns) {
+                    trace_record(TRACE_WRITE, start_ns, trace_now_ns(), pkt.seq, pkt.type,
+                                 pkt.size, 0, 0);
+                }
+                xxh64_update(&d->hash, pkt.data, pkt.size);
+                d->bytes_received += pkt.size;
+                // The progress line changes once per percent, not once per frame
+                unsigned percent = d->file_size ? (uint64_t)d->bytes_received * 100 / d->file_size : 100;
+                if (percent != d->percent_shown || d->bytes_received == d->file_size) {
+                    printf("Received %u/%u bytes\r", d->bytes_received, d->file_size);
                     fflush(stdout);
+                    d->percent_shown = percent;
                 }
-                break;
-                
-            case PKT_END_FILE:
-                // End of file transfer
-                if (file) {
-                    fclose(file);
-                    file = NULL;
+
+                if (d->bytes_received - d->checkpointed >= CHECKPOINT_BYTES) {
+                    Checkpoint ckpt = { d->file_size, d->bytes_received, xxh64_digest(&d->hash) };
+                    save_checkpoint(d->filepath, &ckpt);
+                    d->checkpointed = d->bytes_received;
                 }
-                printf("\nFile transfer completed: %s\n", filename);
-                
-                // Mark treasure on grid
-                client->grid[client->player_y][client->player_x].has_treasure = 1;
-                strncpy(client->grid[client->player_y][client->player_x].treasure_name, 
-                       filename, sizeof(client->grid[client->player_y][client->player_x].treasure_name) - 1);
-                client->treasures_found++;
-                
-                // Handle the treasure file
-                handle_treasure_file(filepath, file_type);
-                return 0;
-                
-            default:
-                break;
-        }
+            }
+            break;
+
+        case PKT_END_FILE:
+            // End of file transfer
+            d->finished = 1;
+            if (d->file_fd >= 0) {
+                close(d->file_fd);
+                d->file_fd = -1;
+
+                char ckptpath[160];
+                snprintf(ckptpath, sizeof(ckptpath), "%s.ckpt", d->filepath);
+
+                // End to end: everything written, resumed prefix included
+                if (d->have_hash && xxh64_digest(&d->hash) != d->content_hash) {
+                    printf("\nError: %s does not match the server's hash, discarded\n",
+                           d->filename);
+                    unlink(d->partpath);
+                    unlink(ckptpath);
+                    end_download(client);
+                    return;
+                }
+
+                // The stored copy takes the place of the partial file
+                if (d->from_cache) {
+                    char objpath[64];
+                    object_path(objpath, sizeof(objpath), d->content_hash);
+                    unlink(d->partpath);
+                    if (link(objpath, d->partpath) < 0) perror("link stored copy failed");
+                }
+                if (rename(d->partpath, d->filepath) < 0) perror("rename failed");
+                // Renaming onto another link to the same file removes neither
+                if (d->from_cache) unlink(d->partpath);
+                unlink(ckptpath);
+                if (d->have_hash && !d->from_cache) store_object(d->filepath, d->content_hash);
+            }
+            printf("\nFile transfer completed: %s\n", d->filename);
+
+            // Mark treasure on grid
+            client->grid[client->player_y][client->player_x].has_treasure = 1;
+            strncpy(client->grid[client->player_y][client->player_x].treasure_name,
+                   d->filename, sizeof(client->grid[client->player_y][client->player_x].treasure_name) - 1);
+            client->treasures_found++;
+
+            // Handle the treasure file
+            handle_treasure_file(d->filepath, d->file_type);
+            end_download(client);
+            return;
+
+        default:
+            break;
     }
-    
-    if (file) fclose(file);
-    return -1;
 }
 
 void handle_treasure_file(const char *filename, PacketType file_type) {
@@ -376,7 +1077,8 @@ void handle_treasure_file(const char *filename, PacketType file_type) {
     }
 }
 
-char get_user_input(void) {
+// One key; -1 at the end of input
+int get_user_input(void) {
     char c;
     if (read(STDIN_FILENO, &c, 1) == 1) {
         // Handle escape sequences for arrow keys
@@ -397,7 +1099,7 @@ char get_user_input(void) {
         }
         return c;
     }
-    return 0;
+    return -1;
 }
 
 void setup_terminal(void) {
@@ -436,4 +1138,9 @@ void create_received_dir(void) {
             printf("Warning: Could not create %s directory\n", RECEIVED_FILES_DIR);
         }
     }
+    if (stat(OBJECTS_DIR, &st) == -1) {
+        if (mkdir(OBJECTS_DIR, 0755) != 0) {
+            printf("Warning: Could not create %s directory\n", OBJECTS_DIR);
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,195 @@
+// evlog.c
+#include "evlog.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+Evlog *evlog;
+
+static int64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void evlog_record(EvlogKind kind, const uint8_t *mac, uint8_t code, int x, int y,
+                  uint16_t item, uint32_t a, uint32_t b) {
+    Evlog *log = evlog;
+    if (!log) return;
+
+    // Claim a cell whose previous record the writer has taken
+    uint64_t pos = atomic_load_explicit(&log->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        uint64_t seq = atomic_load_explicit(&log->cells[pos & (EVLOG_RING_SIZE - 1)].seq,
+                                            memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&log->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&log->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    EvlogRecord *r = &log->cells[pos & (EVLOG_RING_SIZE - 1)].record;
+    r->time_ns = now_ns(CLOCK_MONOTONIC);
+    r->kind = kind;
+    if (mac) {
+        memcpy(r->mac, mac, ETH_ALEN);
+    } else {
+        memset(r->mac, 0, ETH_ALEN);
+    }
+    r->code = code;
+    r->x = x;
+    r->y = y;
+    r->item = item;
+    r->a = a;
+    r->b = b;
+    r->reserved = 0;
+    atomic_store_explicit(&log->cells[pos & (EVLOG_RING_SIZE - 1)].seq, pos + 1,
+                          memory_order_release);
+}
+
+// <path> becomes <path>.1, which becomes <path>.2, and so on; the oldest goes
+static void shift_files(const char *path) {
+    char from[512], to[512];
+    for (int i = EVLOG_KEEP - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", path, i);
+        snprintf(to, sizeof(to), "%s.%d", path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", path);
+    rename(path, to);
+}
+
+static int open_file(Evlog *log) {
+    shift_files(log->path);
+    log->file = fopen(log->path, "wb");
+    if (!log->file) {
+        perror("evlog fopen failed");
+        return -1;
+    }
+    log->header.realtime_offset_ns = now_ns(CLOCK_REALTIME) - now_ns(CLOCK_MONOTONIC);
+    fwrite(&log->header, sizeof(log->header), 1, log->file);
+    log->file_bytes = sizeof(log->header);
+    return 0;
+}
+
+// A file that cannot be reopened after a rotation ends the log; records
+// are then dropped rather than retried against the same error
+static void write_record(Evlog *log, const EvlogRecord *r) {
+    if (!log->file) return;
+    if (log->file_bytes >= EVLOG_FILE_BYTES) {
+        fclose(log->file);
+        log->file = NULL;
+        if (open_file(log) < 0) return;
+    }
+    fwrite(r, sizeof(*r), 1, log->file);
+    log->file_bytes += sizeof(*r);
+}
+
+// Everything pushed so far; returns how many records there were
+static int drain(Evlog *log) {
+    int count = 0;
+    for (;;) {
+        uint64_t pos = log->dequeue_pos;
+        uint64_t seq = atomic_load_explicit(&log->cells[pos & (EVLOG_RING_SIZE - 1)].seq,
+                                            memory_order_acquire);
+        if (seq != pos + 1) break;
+
+        write_record(log, &log->cells[pos & (EVLOG_RING_SIZE - 1)].record);
+        atomic_store_explicit(&log->cells[pos & (EVLOG_RING_SIZE - 1)].seq,
+                              pos + EVLOG_RING_SIZE, memory_order_release);
+        log->dequeue_pos = pos + 1;
+        count++;
+    }
+
+    uint64_t lost = atomic_exchange_explicit(&log->dropped, 0, memory_order_relaxed);
+    if (lost > 0) {
+        EvlogRecord r = { .time_ns = now_ns(CLOCK_MONOTONIC), .kind = EV_DROPPED, .a = lost };
+        write_record(log, &r);
+    }
+    return count;
+}
+
+// Producers never make a system call: the writer finds their records by polling
+static void *writer_main(void *arg) {
+    Evlog *log = arg;
+    for (;;) {
+        int stopping = atomic_load(&log->stop);
+        if (drain(log) > 0) continue;
+        if (stopping) break;
+
+        if (log->file) fflush(log->file);
+        struct timespec idle = { 0, EVLOG_FLUSH_MS * 1000000L };
+        nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+int evlog_start(const char *path, const char (*names)[512], int name_count) {
+    Evlog *log = calloc(1, sizeof(Evlog));
+    if (log) log->cells = calloc(EVLOG_RING_SIZE, sizeof(*log->cells));
+    if (!log || !log->cells) {
+        perror("calloc event log failed");
+        free(log);
+        return -1;
+    }
+    for (uint64_t i = 0; i < EVLOG_RING_SIZE; i++) atomic_init(&log->cells[i].seq, i);
+    log->path = path;
+
+    log->header.magic = EVLOG_MAGIC;
+    log->header.version = EVLOG_VERSION;
+    log->header.record_size = sizeof(EvlogRecord);
+    if (name_count > EVLOG_MAX_NAMES) name_count = EVLOG_MAX_NAMES;
+    log->header.name_count = name_count;
+    for (int i = 0; i < name_count; i++) {
+        const char *base = strrchr(names[i], '/');
+        snprintf(log->header.names[i], EVLOG_NAME_SIZE, "%s", base ? base + 1 : names[i]);
+    }
+
+    if (open_file(log) < 0) {
+        free(log->cells);
+        free(log);
+        return -1;
+    }
+
+    int err = pthread_create(&log->thread, NULL, writer_main, log);
+    if (err) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        fclose(log->file);
+        free(log->cells);
+        free(log);
+        return -1;
+    }
+    evlog = log;
+    return 0;
+}
+
+void evlog_stop(void) {
+    Evlog *log = evlog;
+    if (!log) return;
+
+    evlog = NULL;
+    atomic_store(&log->stop, 1);
+    pthread_join(log->thread, NULL);
+    if (log->file) fclose(log->file);
+    free(log->cells);
+    free(log);
+}
+
+int evlog_read_header(FILE *in, EvlogHeader *header) {
+    if (fread(header, sizeof(*header), 1, in) != 1) return -1;
+    if (header->magic != EVLOG_MAGIC || header->version != EVLOG_VERSION ||
+        header->record_size != sizeof(EvlogRecord)) {
+        return -1;
+    }
+    if (header->name_count > EVLOG_MAX_NAMES) header->name_count = EVLOG_MAX_NAMES;
+    return 0;
+}
@@ -0,0 +1,89 @@
+// evlog.h
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <net/ethernet.h>
+
+#define EVLOG_MAGIC      0x4C564554u  // "TEVL": layout version of the file
+#define EVLOG_VERSION    1
+#define EVLOG_RING_SIZE  (1 << 16)    // Records waiting for the writer (power of two)
+#define EVLOG_FILE_BYTES (16 << 20)   // Start a new file once one holds this much
+#define EVLOG_KEEP       3            // Older files kept as <path>.1 (newest) to <path>.3
+#define EVLOG_FLUSH_MS   100          // The writer looks for records this often when idle
+#define EVLOG_MAX_NAMES  8
+#define EVLOG_NAME_SIZE  64
+
+typedef enum {
+    EV_MOVE = 1,        // code: PacketType, a: 1 applied / 0 refused, x,y: position after it
+    EV_DISCOVER,        // item: treasure, x,y: where it lay
+    EV_TRANSFER_START,  // item: treasure, a: file size, code: 1 = from the frame cache
+    EV_TRANSFER_END,    // item: treasure, a: offset reached, b: bytes sent, code: 1 = completed
+    EV_RETRANSMIT,      // code: seq, a: frames of the transfer resent so far
+    EV_DROPPED          // a: records lost to a full ring (written by the logger itself)
+} EvlogKind;
+
+// Fixed 32 bytes, written to the file as they are (host byte order)
+typedef struct {
+    int64_t time_ns;           // CLOCK_MONOTONIC
+    uint8_t kind;
+    uint8_t mac[ETH_ALEN];     // The client it concerns
+    uint8_t code;
+    int8_t x, y;
+    uint16_t item;
+    uint32_t a, b;
+    uint32_t reserved;
+} EvlogRecord;
+
+// Start of every file: enough to decode it on its own
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    int64_t realtime_offset_ns;  // Add to time_ns for wall-clock time
+    uint32_t name_count;
+    uint32_t reserved;
+    char names[EVLOG_MAX_NAMES][EVLOG_NAME_SIZE];  // Treasure file names, by item
+} EvlogHeader;
+
+// Bounded lock-free ring: any thread pushes, the writer thread pops. A full
+// ring drops the record and counts it rather than make a hot path wait.
+typedef struct {
+    struct {
+        _Atomic uint64_t seq;
+        EvlogRecord record;
+    } *cells;
+    _Atomic uint64_t enqueue_pos;
+    uint64_t dequeue_pos;
+    _Atomic uint64_t dropped;
+    _Atomic int stop;
+    pthread_t thread;
+    const char *path;
+    FILE *file;
+    size_t file_bytes;
+    EvlogHeader header;
+} Evlog;
+
+// Non-NULL while logging; hot paths test it before doing any work
+extern Evlog *evlog;
+
+static inline int evlog_on(void) {
+    return evlog != NULL;
+}
+
+// Log to `path`, moving an existing file aside (call before threads start)
+int  evlog_start(const char *path, const char (*names)[512], int name_count);
+// Write out everything pushed so far and close the file (once no thread logs)
+void evlog_stop(void);
+
+void evlog_record(EvlogKind kind, const uint8_t *mac, uint8_t code, int x, int y,
+                  uint16_t item, uint32_t a, uint32_t b);
+
+// Decoder side: check a file's header (0 if it is a log this build can read)
+int evlog_read_header(FILE *in, EvlogHeader *header);
+
+#endif // EVLOG_H
@@ -0,0 +1,53 @@
+#include "filesrc.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Map the whole file once; the descriptor is not needed after mmap
+int file_source_open(FileSource *src, const char *path) {
+    src->data = NULL;
+    src->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+
+    // mmap rejects a zero length; an empty file simply has no data
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            return -1;
+        }
+
+        // Frames are sent front to back: read ahead aggressively, drop pages behind
+        if (madvise(map, st.st_size, MADV_SEQUENTIAL) < 0) {
+            perror("madvise");
+        }
+        src->data = map;
+    }
+
+    src->size = st.st_size;
+    close(fd);
+    return 0;
+}
+
+void file_source_close(FileSource *src) {
+    if (src->data) {
+        munmap((void *)src->data, src->size);
+    }
+    src->data = NULL;
+    src->size = 0;
+}
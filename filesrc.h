@@ -0,0 +1,18 @@
+// filesrc.h
+#ifndef FILESRC_H
+#define FILESRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A file mapped read-only for sending; frames are built straight from the
+// mapping instead of being read into intermediate buffers
+typedef struct {
+    const uint8_t *data;  // NULL for an empty file
+    size_t size;
+} FileSource;
+
+int  file_source_open(FileSource *src, const char *path);
+void file_source_close(FileSource *src);
+
+#endif // FILESRC_H
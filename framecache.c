@@ -0,0 +1,155 @@
+#include "framecache.h"
+#include "filesrc.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+void frame_cache_init(FrameCache *cache, size_t budget) {
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = budget;
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+static void free_entry(CacheEntry *entry) {
+    free(entry->frames);
+    free(entry);
+}
+
+void frame_cache_destroy(FrameCache *cache) {
+    CacheEntry *entry = cache->head;
+    while (entry) {
+        CacheEntry *next = entry->next;
+        free_entry(entry);
+        entry = next;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void unlink_entry(FrameCache *cache, CacheEntry *entry) {
+    if (entry->prev) entry->prev->next = entry->next; else cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev; else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void push_front(FrameCache *cache, CacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    cache->head = entry;
+    if (!cache->tail) cache->tail = entry;
+}
+
+static CacheEntry *find_entry(FrameCache *cache, const char *path) {
+    for (CacheEntry *entry = cache->head; entry; entry = entry->next) {
+        if (strcmp(entry->path, path) == 0) return entry;
+    }
+    return NULL;
+}
+
+// Evict unused entries from the cold end until `bytes` more fit
+static int make_room(FrameCache *cache, size_t bytes) {
+    CacheEntry *entry = cache->tail;
+    while (cache->used + bytes > cache->budget && entry) {
+        CacheEntry *prev = entry->prev;
+        if (entry->users == 0) {
+            unlink_entry(cache, entry);
+            cache->used -= entry->bytes;
+            cache->evictions++;
+            free_entry(entry);
+        }
+        entry = prev;
+    }
+    return cache->used + bytes <= cache->budget ? 0 : -1;
+}
+
+// Read the file once and encode every data frame with seq 0
+static CacheEntry *encode_file(const char *path, size_t budget) {
+    FileSource src;
+    if (file_source_open(&src, path) < 0) return NULL;
+
+    // Files that could never fit are not worth reading
+    size_t count = (src.size + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE;
+    if (sizeof(CacheEntry) + count * sizeof(PacketRaw) > budget) {
+        file_source_close(&src);
+        return NULL;
+    }
+
+    CacheEntry *entry = calloc(1, sizeof(CacheEntry));
+    if (!entry || (count > 0 && !(entry->frames = calloc(count, sizeof(PacketRaw))))) {
+        perror("calloc");
+        free(entry);
+        file_source_close(&src);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = i * MAX_DATA_SIZE;
+        size_t chunk = src.size - offset < MAX_DATA_SIZE ? src.size - offset : MAX_DATA_SIZE;
+
+        Packet header = {
+            .start_marker = START_MARKER,
+            .size = chunk,
+            .seq = 0,
+            .type = PKT_DATA
+        };
+        header.checksum = calculate_crc_data(&header, src.data + offset);
+        pack_header(&header, &entry->frames[i]);
+        memcpy(entry->frames[i].data, src.data + offset, chunk);
+    }
+
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    entry->frame_count = count;
+    entry->size = src.size;
+    entry->bytes = sizeof(CacheEntry) + count * sizeof(PacketRaw);
+    file_source_close(&src);
+    return entry;
+}
+
+const CacheEntry *frame_cache_acquire(FrameCache *cache, const char *path) {
+    if (cache->budget == 0) return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = find_entry(cache, path);
+    if (entry) {
+        cache->hits++;
+        entry->users++;
+        unlink_entry(cache, entry);
+        push_front(cache, entry);
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Encode without the lock; other transfers keep using the cache meanwhile
+    CacheEntry *loaded = encode_file(path, cache->budget);
+    if (!loaded) return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = find_entry(cache, path);  // Someone else may have loaded it first
+    if (entry) {
+        free_entry(loaded);
+    } else if (make_room(cache, loaded->bytes) == 0) {
+        entry = loaded;
+        cache->used += entry->bytes;
+        push_front(cache, entry);
+    } else {
+        free_entry(loaded);
+        pthread_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+
+    entry->users++;
+    unlink_entry(cache, entry);
+    push_front(cache, entry);
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+void frame_cache_release(FrameCache *cache, const CacheEntry *entry) {
+    if (!entry) return;
+
+    pthread_mutex_lock(&cache->lock);
+    ((CacheEntry *)entry)->users--;
+    pthread_mutex_unlock(&cache->lock);
+}
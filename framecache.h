@@ -0,0 +1,36 @@
+// framecache.h
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+#include "sockets.h"
+#include <pthread.h>
+
+// A treasure split into wire-ready data frames. Each frame is encoded with
+// seq 0 and its checksum already computed; senders only patch the seq.
+typedef struct CacheEntry {
+    struct CacheEntry *prev, *next;  // LRU list, most recently used first
+    char path[512];
+    PacketRaw *frames;
+    size_t frame_count;
+    size_t size;        // File size in bytes
+    size_t bytes;       // Memory charged against the budget
+    int users;          // Transfers sending from this entry; never evicted while > 0
+} CacheEntry;
+
+typedef struct {
+    size_t budget;      // Bytes of frames the cache may hold
+    size_t used;
+    CacheEntry *head, *tail;
+    pthread_mutex_t lock;
+    unsigned long hits, misses, evictions;
+} FrameCache;
+
+void frame_cache_init(FrameCache *cache, size_t budget);
+void frame_cache_destroy(FrameCache *cache);
+
+// Returns the encoded file, loading it on a miss, or NULL when it cannot be
+// cached (too big for the budget, or every other entry is in use)
+const CacheEntry *frame_cache_acquire(FrameCache *cache, const char *path);
+void frame_cache_release(FrameCache *cache, const CacheEntry *entry);
+
+#endif // FRAMECACHE_H
@@ -0,0 +1,114 @@
+// logview.c
+// Prints the event log a server started with -L writes, one line per record.
+// Rotated files can be given in order: ./logview events.log.2 events.log.1 events.log
+#include "evlog.h"
+#include "sockets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *move_name(uint8_t type) {
+    switch (type) {
+        case PKT_MOVE_RIGHT: return "RIGHT";
+        case PKT_MOVE_LEFT:  return "LEFT";
+        case PKT_MOVE_UP:    return "UP";
+        case PKT_MOVE_DOWN:  return "DOWN";
+        default:             return "?";
+    }
+}
+
+static const char *treasure_name(const EvlogHeader *header, uint16_t item) {
+    return item < header->name_count ? header->names[item] : "?";
+}
+
+static void print_record(const EvlogHeader *header, const EvlogRecord *r, int monotonic) {
+    if (monotonic) {
+        printf("%lld.%06lld", (long long)(r->time_ns / 1000000000),
+               (long long)(r->time_ns % 1000000000 / 1000));
+    } else {
+        int64_t wall_ns = r->time_ns + header->realtime_offset_ns;
+        time_t sec = wall_ns / 1000000000;
+        struct tm tm;
+        char when[32];
+        localtime_r(&sec, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        printf("%s.%06lld", when, (long long)(wall_ns % 1000000000 / 1000));
+    }
+    printf(" %02x:%02x:%02x:%02x:%02x:%02x ",
+           r->mac[0], r->mac[1], r->mac[2], r->mac[3], r->mac[4], r->mac[5]);
+
+    switch (r->kind) {
+        case EV_MOVE:
+            if (r->a) {
+                printf("move %s to (%d,%d)\n", move_name(r->code), r->x, r->y);
+            } else {
+                printf("move %s refused at (%d,%d)\n", move_name(r->code), r->x, r->y);
+            }
+            break;
+        case EV_DISCOVER:
+            printf("discover %s at (%d,%d)\n", treasure_name(header, r->item), r->x, r->y);
+            break;
+        case EV_TRANSFER_START:
+            printf("transfer %s started, %u bytes%s\n", treasure_name(header, r->item), r->a,
+                   r->code ? ", cached" : "");
+            break;
+        case EV_TRANSFER_END:
+            printf("transfer %s %s at %u bytes, %u sent\n", treasure_name(header, r->item),
+                   r->code ? "completed" : "failed", r->a, r->b);
+            break;
+        case EV_RETRANSMIT:
+            printf("retransmit seq %u (%u so far)\n", r->code, r->a);
+            break;
+        case EV_DROPPED:
+            printf("%u records dropped, ring full\n", r->a);
+            break;
+        default:
+            printf("unknown record kind %u\n", r->kind);
+            break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int monotonic = 0;   // Raw CLOCK_MONOTONIC seconds instead of wall-clock time
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m")) != -1) {
+        switch (opt) {
+            case 'm':
+                monotonic = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-m] <log_file>...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-m] <log_file>...\n", argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        FILE *in = fopen(argv[i], "rb");
+        if (!in) {
+            perror(argv[i]);
+            status = 1;
+            continue;
+        }
+
+        EvlogHeader header;
+        if (evlog_read_header(in, &header) < 0) {
+            fprintf(stderr, "%s: not an event log of this version\n", argv[i]);
+            fclose(in);
+            status = 1;
+            continue;
+        }
+
+        // A record cut short by a crash ends the file
+        EvlogRecord r;
+        while (fread(&r, sizeof(r), 1, in) == 1) print_record(&header, &r, monotonic);
+        fclose(in);
+    }
+    return status;
+}
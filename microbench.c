@@ -0,0 +1,183 @@
+// microbench.c
+// Per-frame cost of the framing primitives: pack_packet, unpack_packet,
+// calculate_crc and validate_packet, for each payload size, plus the CRC-8
+// that extended frames can use instead
+#include "sockets.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define POOL_FRAMES 256   // Frames cycled through so the data is not all the same
+
+typedef enum { PRIM_PACK, PRIM_UNPACK, PRIM_CRC, PRIM_VALIDATE, PRIM_CRC8, PRIM_COUNT } Primitive;
+
+static const char *primitive_names[PRIM_COUNT] = { "pack", "unpack", "crc", "validate", "crc8" };
+
+static Packet logical[POOL_FRAMES];
+static PacketRaw raw[POOL_FRAMES];
+static volatile uint64_t sink;   // Keeps the results alive
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Fill the pool with valid frames of one payload size
+static void build_pool(int size, int random_data, unsigned *seed) {
+    for (int i = 0; i < POOL_FRAMES; i++) {
+        Packet *pkt = &logical[i];
+        memset(pkt, 0, sizeof(*pkt));
+        pkt->start_marker = START_MARKER;
+        pkt->size = size;
+        pkt->seq = random_data ? rand_r(seed) & 0x1F : i & 0x1F;
+        pkt->type = random_data ? rand_r(seed) % (PKT_ERROR + 1) : PKT_DATA;
+        for (int j = 0; j < size; j++) {
+            pkt->data[j] = random_data ? rand_r(seed) : (uint8_t)(i + j);
+        }
+        pkt->checksum = calculate_crc(pkt);
+        pack_packet(pkt, &raw[i]);
+    }
+}
+
+static void run_primitive(Primitive prim, long iterations) {
+    PacketRaw raw_out;
+    Packet out;
+    uint64_t acc = 0;
+
+    for (long i = 0; i < iterations; i++) {
+        int k = i & (POOL_FRAMES - 1);
+        switch (prim) {
+            case PRIM_PACK:
+                acc += pack_packet(&logical[k], &raw_out);
+                acc += raw_out.checksum;
+                break;
+            case PRIM_UNPACK:
+                unpack_packet(&raw[k], &out);
+                acc += out.checksum + out.data[0];
+                break;
+            case PRIM_CRC:
+                acc += calculate_crc(&logical[k]);
+                break;
+            case PRIM_VALIDATE:
+                acc += validate_packet(&logical[k]);
+                break;
+            case PRIM_CRC8:
+                acc += crc8_update(0, logical[k].data, logical[k].size);
+                break;
+            default:
+                break;
+        }
+    }
+    sink += acc;
+}
+
+// "0-127" or "0,1,64,127"
+static int parse_sizes(char *list, int *sizes, int max) {
+    int count = 0;
+    char *save;
+    for (char *item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        int first, last;
+        char *dash = strchr(item, '-');
+        first = atoi(item);
+        last = dash ? atoi(dash + 1) : first;
+        if (first < 0 || last > MAX_DATA_SIZE || first > last) return -1;
+        for (int size = first; size <= last; size++) {
+            if (count == max) return -1;
+            sizes[count++] = size;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = 2000000;
+    long warmup = 200000;
+    int random_data = 0;
+    char default_sizes[] = "0,1,2,4,8,16,32,64,96,127";
+    char *size_list = default_sizes;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:s:rk:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            case 'w':
+                warmup = atol(optarg);
+                break;
+            case 's':
+                size_list = optarg;
+                break;
+            case 'r':
+                random_data = 1;
+                break;
+            case 'k':
+                if (checksum_use_kernel(optarg) < 0) {
+                    fprintf(stderr, "Checksum kernel '%s' is unknown or not supported here\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-w warmup] [-s sizes] [-r] "
+                                "[-k avx2|sse2|word|byte]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iterations < 1 || warmup < 0) {
+        fprintf(stderr, "Iterations must be positive and warm-up not negative\n");
+        return 1;
+    }
+
+    // Room for every size, even with repeats in the list
+    int sizes[4 * (MAX_DATA_SIZE + 1)];
+    int size_count = parse_sizes(size_list, sizes, sizeof(sizes) / sizeof(sizes[0]));
+    if (size_count <= 0) {
+        fprintf(stderr, "Sizes must be a list or range within 0-%d (like 0-127 or 0,64,127)\n",
+                MAX_DATA_SIZE);
+        return 1;
+    }
+
+    unsigned seed = 1;
+    printf("# %s data, %ld iterations after %ld warm-up, %s XOR kernel\n",
+           random_data ? "random" : "patterned", iterations, warmup, checksum_kernel());
+    printf("%-10s %5s %12s %12s\n", "primitive", "size", "ns/frame", "cycles/frame");
+
+    for (int s = 0; s < size_count; s++) {
+        build_pool(sizes[s], random_data, &seed);
+        for (int p = 0; p < PRIM_COUNT; p++) {
+            run_primitive(p, warmup);
+
+            long long start_ns = now_ns();
+            uint64_t start_cycles = now_cycles();
+            run_primitive(p, iterations);
+            uint64_t cycles = now_cycles() - start_cycles;
+            long long ns = now_ns() - start_ns;
+
+#ifdef HAVE_TSC
+            printf("%-10s %5d %12.2f %12.2f\n", primitive_names[p], sizes[s],
+                   (double)ns / iterations, (double)cycles / iterations);
+#else
+            (void)cycles;
+            printf("%-10s %5d %12.2f %12s\n", primitive_names[p], sizes[s],
+                   (double)ns / iterations, "-");
+#endif
+        }
+    }
+    return 0;
+}
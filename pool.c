@@ -0,0 +1,261 @@
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#define POOL_IDLE_POLL_MS 10  // Idle workers look for work to steal this often
+
+static size_t round_up_pow2(size_t n) {
+    size_t size = 1;
+    while (size < n) size <<= 1;
+    return size;
+}
+
+int spsc_init(SpscQueue *q, size_t capacity, size_t item_size) {
+    size_t size = round_up_pow2(capacity);
+    q->items = malloc(size * item_size);
+    if (!q->items) {
+        perror("malloc");
+        return -1;
+    }
+    q->mask = size - 1;
+    q->item_size = item_size;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return 0;
+}
+
+void spsc_destroy(SpscQueue *q) {
+    free(q->items);
+    q->items = NULL;
+}
+
+int spsc_full(const SpscQueue *q) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    return tail - head > q->mask;
+}
+
+int spsc_push(SpscQueue *q, const void *item) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head > q->mask) return -1;
+
+    memcpy(q->items + (tail & q->mask) * q->item_size, item, q->item_size);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+int spsc_pop(SpscQueue *q, void *item) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) return -1;
+
+    memcpy(item, q->items + (head & q->mask) * q->item_size, q->item_size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 0;
+}
+
+// Each cell carries a sequence number that tells producers and consumers
+// whether it is free for the current lap of the ring
+static int run_queue_init(RunQueue *q) {
+    q->cells = calloc(RUN_QUEUE_SIZE, sizeof(*q->cells));
+    if (!q->cells) {
+        perror("calloc");
+        return -1;
+    }
+    q->mask = RUN_QUEUE_SIZE - 1;
+    for (size_t i = 0; i < RUN_QUEUE_SIZE; i++) {
+        atomic_init(&q->cells[i].seq, i);
+    }
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    return 0;
+}
+
+static int run_queue_push(RunQueue *q, void *task) {
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+
+    while (1) {
+        size_t seq = atomic_load_explicit(&q->cells[pos & q->mask].seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;  // Full
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    q->cells[pos & q->mask].task = task;
+    atomic_store_explicit(&q->cells[pos & q->mask].seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+static void *run_queue_pop(RunQueue *q) {
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+
+    while (1) {
+        size_t seq = atomic_load_explicit(&q->cells[pos & q->mask].seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL;  // Empty
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    void *task = q->cells[pos & q->mask].task;
+    atomic_store_explicit(&q->cells[pos & q->mask].seq, pos + q->mask + 1, memory_order_release);
+    return task;
+}
+
+static void wake_worker(Worker *w) {
+    uint64_t one = 1;
+    if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+        // Counter saturated: the worker is already due to wake up
+    }
+}
+
+// Take a task from another worker, starting with the next one
+static void *steal_task(Worker *w) {
+    WorkerPool *pool = w->pool;
+    for (int i = 1; i < pool->worker_count; i++) {
+        Worker *victim = &pool->workers[(w->index + i) % pool->worker_count];
+        void *task = run_queue_pop(&victim->queue);
+        if (task) {
+            atomic_fetch_add_explicit(&w->stolen, 1, memory_order_relaxed);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    WorkerPool *pool = w->pool;
+
+    while (!atomic_load(&pool->stop)) {
+        void *task = run_queue_pop(&w->queue);
+        if (!task) task = steal_task(w);
+        if (task) {
+            pool->run(task, pool->arg);
+            continue;
+        }
+
+        // Announce the nap first, then look once more: a submit that raced
+        // with us either sees the flag or left a task we find here
+        atomic_store(&w->sleeping, 1);
+        task = run_queue_pop(&w->queue);
+        if (task) {
+            atomic_store(&w->sleeping, 0);
+            pool->run(task, pool->arg);
+            continue;
+        }
+
+        struct pollfd pfd = { .fd = w->wake_fd, .events = POLLIN };
+        poll(&pfd, 1, POOL_IDLE_POLL_MS);
+        atomic_store(&w->sleeping, 0);
+
+        uint64_t count;
+        if (read(w->wake_fd, &count, sizeof(count)) < 0) {
+            // EAGAIN: woken by the poll timeout
+        }
+    }
+    return NULL;
+}
+
+WorkerPool *pool_create(int worker_count, PoolRunFn run, void *arg) {
+    if (worker_count < 1 || worker_count > POOL_MAX_WORKERS) return NULL;
+
+    WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+    if (!pool) {
+        perror("calloc");
+        return NULL;
+    }
+    pool->run = run;
+    pool->arg = arg;
+    atomic_init(&pool->stop, 0);
+
+    for (int i = 0; i < worker_count; i++) {
+        Worker *w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        w->wake_fd = eventfd(0, EFD_NONBLOCK);
+        pool->worker_count = i + 1;
+        if (w->wake_fd < 0 || run_queue_init(&w->queue) < 0) {
+            perror("worker setup");
+            pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        int err = pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]);
+        if (err) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            pool_destroy(pool);
+            return NULL;
+        }
+        pool->threads_started++;
+    }
+
+    return pool;
+}
+
+// Queue a task on the worker picked by hint (or the next one with room) and
+// make sure someone is awake to run it
+int pool_submit(WorkerPool *pool, void *task, unsigned hint) {
+    int home = hint % pool->worker_count;
+    int target = -1;
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        int index = (home + i) % pool->worker_count;
+        if (run_queue_push(&pool->workers[index].queue, task) == 0) {
+            target = index;
+            break;
+        }
+    }
+    if (target < 0) return -1;
+
+    if (atomic_load(&pool->workers[target].sleeping)) {
+        wake_worker(&pool->workers[target]);
+        return 0;
+    }
+
+    // The owner is busy: let an idle worker steal the task
+    for (int i = 1; i < pool->worker_count; i++) {
+        Worker *w = &pool->workers[(target + i) % pool->worker_count];
+        if (atomic_load(&w->sleeping)) {
+            wake_worker(w);
+            break;
+        }
+    }
+    return 0;
+}
+
+void pool_destroy(WorkerPool *pool) {
+    if (!pool) return;
+
+    atomic_store(&pool->stop, 1);
+    for (int i = 0; i < pool->threads_started; i++) wake_worker(&pool->workers[i]);
+    for (int i = 0; i < pool->threads_started; i++) pthread_join(pool->workers[i].thread, NULL);
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        if (pool->workers[i].wake_fd >= 0) close(pool->workers[i].wake_fd);
+        free(pool->workers[i].queue.cells);
+    }
+    free(pool);
+}
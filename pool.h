@@ -0,0 +1,70 @@
+// pool.h
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define POOL_MAX_WORKERS  64
+#define RUN_QUEUE_SIZE    1024  // Runnable tasks per worker (power of two)
+
+// Lock-free ring with one producer thread and one consumer thread.
+// Slots hold fixed-size items that are copied in and out.
+typedef struct {
+    _Atomic size_t head;   // Next slot to read (consumer)
+    _Atomic size_t tail;   // Next slot to write (producer)
+    size_t mask;
+    size_t item_size;
+    uint8_t *items;
+} SpscQueue;
+
+// Bounded lock-free queue of task pointers. Any thread may push, and the
+// owning worker as well as idle thieves may pop, so stealing needs no lock.
+typedef struct {
+    struct {
+        _Atomic size_t seq;
+        void *task;
+    } *cells;
+    size_t mask;
+    _Atomic size_t enqueue_pos;
+    _Atomic size_t dequeue_pos;
+} RunQueue;
+
+typedef void (*PoolRunFn)(void *task, void *arg);
+
+typedef struct WorkerPool WorkerPool;
+
+typedef struct {
+    WorkerPool *pool;
+    int index;
+    pthread_t thread;
+    RunQueue queue;
+    int wake_fd;            // eventfd that interrupts an idle wait
+    _Atomic int sleeping;
+    _Atomic unsigned long stolen;  // Tasks this worker took from other queues
+} Worker;
+
+struct WorkerPool {
+    Worker workers[POOL_MAX_WORKERS];
+    int worker_count;
+    int threads_started;
+    PoolRunFn run;
+    void *arg;
+    _Atomic int stop;
+};
+
+// SPSC ring; capacity is rounded up to a power of two
+int  spsc_init(SpscQueue *q, size_t capacity, size_t item_size);
+void spsc_destroy(SpscQueue *q);
+int  spsc_full(const SpscQueue *q);   // Producer side
+int  spsc_push(SpscQueue *q, const void *item);
+int  spsc_pop(SpscQueue *q, void *item);
+
+// Worker pool: run(task, arg) is called on one of the workers for each submit
+WorkerPool *pool_create(int worker_count, PoolRunFn run, void *arg);
+int  pool_submit(WorkerPool *pool, void *task, unsigned hint);
+void pool_destroy(WorkerPool *pool);
+
+#endif // POOL_H
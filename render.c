@@ -0,0 +1,226 @@
+// render.c
+#include "render.h"
+#include "sockets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define ROW_GRID      6   // Top row of the grid (y = GRID_SIZE - 1)
+#define ROW_TREASURES 16
+#define ROW_END       (ROW_TREASURES + MAX_TREASURES)
+#define MIN_LOG_ROWS  4   // Terminal lines left for the log below the panel
+#define RUN_GAP       8   // About the length of the escapes around a run
+
+// The panel as text, one line per row; the grid is drawn from the treasure
+// positions here rather than on the packet path
+static void compose(const Renderer *r, const BoardView *view, int valid,
+                    char lines[RENDER_ROWS][RENDER_COLS]) {
+    memset(lines, 0, RENDER_ROWS * RENDER_COLS);
+    if (!valid) {
+        snprintf(lines[0], RENDER_COLS, "=== SERVER STATE: waiting for clients ===");
+        return;
+    }
+
+    int found = 0;
+    for (int i = 0; i < view->treasure_count; i++) found += view->treasures[i].discovered;
+
+    snprintf(lines[0], RENDER_COLS, "=== SERVER STATE: %02x:%02x:%02x:%02x:%02x:%02x ===",
+             view->mac[0], view->mac[1], view->mac[2], view->mac[3], view->mac[4], view->mac[5]);
+    snprintf(lines[1], RENDER_COLS, "Player position: (%d, %d)", view->player_x, view->player_y);
+    snprintf(lines[2], RENDER_COLS, "Treasures found: %d/%d", found, view->treasure_count);
+    snprintf(lines[4], RENDER_COLS, "Grid (P=Player, T=Treasure, D=Discovered, .=Empty):");
+
+    char *header = lines[ROW_GRID - 1];
+    header[0] = header[1] = ' ';
+    for (int x = 0; x < GRID_SIZE; x++) {
+        header[2 + 2 * x] = '0' + x;
+        header[3 + 2 * x] = ' ';
+    }
+
+    for (int y = GRID_SIZE - 1; y >= 0; y--) {
+        char *row = lines[ROW_GRID + GRID_SIZE - 1 - y];
+        row[0] = '0' + y;
+        row[1] = ' ';
+        for (int x = 0; x < GRID_SIZE; x++) {
+            row[2 + 2 * x] = '.';
+            row[3 + 2 * x] = ' ';
+        }
+    }
+    for (int i = 0; i < view->treasure_count; i++) {
+        char *row = lines[ROW_GRID + GRID_SIZE - 1 - view->treasures[i].y];
+        row[2 + 2 * view->treasures[i].x] = view->treasures[i].discovered ? 'D' : 'T';
+    }
+    lines[ROW_GRID + GRID_SIZE - 1 - view->player_y][2 + 2 * view->player_x] = 'P';
+
+    snprintf(lines[ROW_TREASURES - 1], RENDER_COLS, "Treasure locations:");
+    for (int i = 0; i < view->treasure_count; i++) {
+        snprintf(lines[ROW_TREASURES + i], RENDER_COLS, "  %s at (%d,%d) - %s",
+                 r->names[i], view->treasures[i].x, view->treasures[i].y,
+                 view->treasures[i].discovered ? "DISCOVERED" : "hidden");
+    }
+    snprintf(lines[ROW_END], RENDER_COLS, "========================");
+}
+
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n <= 0) return;  // Nobody to show it to; the game goes on
+        buf += n;
+        len -= n;
+    }
+}
+
+// Cursor moves to every run of characters that differ from what the
+// terminal shows, inside a save/restore so the log's cursor stays put
+static void draw_diff(Renderer *r, char lines[RENDER_ROWS][RENDER_COLS]) {
+    char out[RENDER_ROWS * RENDER_COLS * 16];  // Room for an escape every other column
+    size_t len = 0;
+
+    for (int row = 0; row < RENDER_ROWS; row++) {
+        char now[RENDER_COLS], was[RENDER_COLS];
+        for (int col = 0; col < RENDER_COLS; col++) {
+            now[col] = lines[row][col] ? lines[row][col] : ' ';
+            was[col] = r->shown[row][col] ? r->shown[row][col] : ' ';
+        }
+
+        int col = 0;
+        while (col < RENDER_COLS - 1) {
+            if (now[col] == was[col]) {
+                col++;
+                continue;
+            }
+            // Unchanged characters shorter than a cursor move are rewritten
+            int end = col + 1, last = col;
+            while (end < RENDER_COLS - 1 && end - last <= RUN_GAP) {
+                if (now[end] != was[end]) last = end;
+                end++;
+            }
+            len += sprintf(out + len, "\0337\033[%d;%dH", row + 1, col + 1);
+            memcpy(out + len, now + col, last + 1 - col);
+            len += last + 1 - col;
+            len += sprintf(out + len, "\0338");
+            col = last + 1;
+        }
+    }
+    memcpy(r->shown, lines, sizeof(r->shown));
+    write_all(out, len);
+}
+
+// No terminal to draw on: the whole board, as a block of the log
+static void draw_plain(char lines[RENDER_ROWS][RENDER_COLS]) {
+    flockfile(stdout);
+    for (int row = 0; row <= ROW_END; row++) {
+        if (row >= ROW_TREASURES && row < ROW_END && !lines[row][0]) continue;
+        fputs(lines[row], stdout);
+        fputc('\n', stdout);
+    }
+    fputc('\n', stdout);
+    funlockfile(stdout);
+}
+
+// Draws the newest snapshot, then rests for the rest of the frame; boards
+// published meanwhile only replace each other
+static void *render_main(void *arg) {
+    Renderer *r = arg;
+    unsigned long drawn = 0;
+    char lines[RENDER_ROWS][RENDER_COLS];
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop) {
+        if (r->version == drawn) {
+            pthread_cond_wait(&r->changed, &r->lock);
+            continue;
+        }
+        BoardView view = r->latest;
+        drawn = r->version;
+        pthread_mutex_unlock(&r->lock);
+
+        compose(r, &view, 1, lines);
+        if (r->ansi) {
+            draw_diff(r, lines);
+        } else {
+            draw_plain(lines);
+        }
+
+        struct timespec frame = { 0, 1000000000L / RENDER_HZ };
+        nanosleep(&frame, NULL);
+        pthread_mutex_lock(&r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+// Give the whole screen back to the log and carry on below everything
+static void release(Renderer *r) {
+    if (r->ansi) {
+        char reset[32];
+        fflush(stdout);
+        int n = snprintf(reset, sizeof(reset), "\033[r\033[%d;1H\n", r->rows);
+        write_all(reset, n);
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->changed);
+    free(r);
+}
+
+Renderer *render_start(const char (*names)[512]) {
+    Renderer *r = calloc(1, sizeof(Renderer));
+    if (!r) {
+        perror("calloc");
+        return NULL;
+    }
+    r->names = names;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->changed, NULL);
+
+    // The panel needs the top of a terminal tall enough to leave room for the log
+    struct winsize ws;
+    if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 &&
+        ws.ws_row >= RENDER_ROWS + MIN_LOG_ROWS) {
+        r->ansi = 1;
+        r->rows = ws.ws_row;
+    }
+
+    if (r->ansi) {
+        // Clear the screen and keep the log scrolling below the panel
+        char lines[RENDER_ROWS][RENDER_COLS];
+        char setup[64];
+        fflush(stdout);
+        write_all("\033[2J", 4);
+        compose(r, NULL, 0, lines);
+        draw_diff(r, lines);
+        int n = snprintf(setup, sizeof(setup), "\033[%d;%dr\033[%d;1H",
+                         RENDER_ROWS + 1, r->rows, RENDER_ROWS + 1);
+        write_all(setup, n);
+    }
+
+    int err = pthread_create(&r->thread, NULL, render_main, r);
+    if (err) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        release(r);
+        return NULL;
+    }
+    return r;
+}
+
+void render_publish(Renderer *r, const BoardView *view) {
+    pthread_mutex_lock(&r->lock);
+    r->latest = *view;
+    r->version++;
+    pthread_cond_signal(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void render_stop(Renderer *r) {
+    if (!r) return;
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_signal(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    release(r);
+}
@@ -0,0 +1,48 @@
+// render.h
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "sockets.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#define RENDER_HZ   30   // Console redraws per second, at most
+#define RENDER_ROWS 26   // Lines of the board panel
+#define RENDER_COLS 80
+
+// What the console shows of one session: copied on the packet path, so it
+// holds only what changes; names come from the server's treasure list
+typedef struct {
+    uint8_t mac[ETH_ALEN];
+    int8_t player_x, player_y;
+    uint8_t treasure_count;
+    struct {
+        int8_t x, y;
+        uint8_t discovered;
+    } treasures[MAX_TREASURES];
+} BoardView;
+
+// The board of the session heard from last, drawn by a thread of its own.
+// On a terminal the panel stays at the top and only changed characters are
+// redrawn; otherwise each new board is printed whole.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    BoardView latest;         // Last snapshot published
+    unsigned long version;    // Bumped by every publish (0 = none yet)
+    int stop;
+    int ansi;                 // Cursor addressing on a terminal of `rows` lines
+    int rows;
+    const char (*names)[512];
+    char shown[RENDER_ROWS][RENDER_COLS];  // What the terminal holds now
+} Renderer;
+
+// Takes over stdout's terminal until render_stop (NULL on failure)
+Renderer *render_start(const char (*names)[512]);
+void      render_stop(Renderer *r);
+
+// Cheap enough for the packet path: a copy under a lock nobody holds for long
+void render_publish(Renderer *r, const BoardView *view);
+
+#endif // RENDER_H
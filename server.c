@@ -1,137 +1,826 @@
 #include "sockets.h"
+#include "arq.h"
+#include "pool.h"
+#include "filesrc.h"
+#include "framecache.h"
+#include "stats.h"
+#include "trace.h"
+#include "checksum.h"
+#include "render.h"
+#include "evlog.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <signal.h>
 #include <dirent.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <getopt.h>
 
-#define GRID_SIZE 8
-#define MAX_TREASURES 8
 #define OBJECTS_DIR "./objetos"
 
+#define SESSION_BUCKETS 256                      // Hash table size for client sessions
+#define MAX_SESSIONS 1024                        // Never more than one run queue can hold
+#define SESSION_INBOX_SIZE 64                    // Threaded mode: frames queued per session
+#define SESSION_IDLE_MS (10 * 60 * 1000)         // Forget clients silent for 10 minutes
+#define HOUSEKEEPING_US 1000000                  // Timer period when nothing is in flight
+#define STATS_FILE_PERIOD_US 1000000             // Rewrite the -s stats file this often
+#define RESUME_WAIT_US 2000000                   // Start from byte 0 if no EXT_RESUME comes
+#define MAX_EVENTS 16
+
 typedef struct {
     int x, y;
     char filename[512];  // Increased from 64 to 512 to accommodate full paths
+    uint64_t hash;       // XXH64 of the contents
     int discovered;
 } Treasure;
 
+// File transfers advance one frame at a time as the window opens
+typedef enum {
+    XFER_IDLE,
+    XFER_SIZE,   // Next frame: file size and position
+    XFER_NAME,   // Next frame: file name and type
+    XFER_RESUME, // Waiting for the client's EXT_RESUME
+    XFER_OFFSET, // Next frame: EXT_RESUME_ACK with the offset data starts at
+    XFER_DATA,   // Data frames until end of file
+    XFER_EOF,    // Next frame: end of file
+    XFER_DRAIN   // Everything sent, waiting for the last ACKs
+} TransferStage;
+
+typedef struct {
+    TransferStage stage;
+    FileSource source;   // The treasure, mapped for the duration of the transfer
+    FrameCache *cache;
+    const CacheEntry *cached;  // Pre-encoded frames, used instead of source when set
+    char filepath[512];
+    PacketType file_type;
+    size_t file_size;
+    size_t total_sent;
+    uint64_t content_hash;     // XXH64 of the whole file, sent with the size
+    int treasure;              // Index in the treasure list, for the event log
+    size_t resume_offset;      // Bytes the client already held
+    long long resume_deadline; // XFER_RESUME: give up waiting at this time (us)
+    ArqSender arq;
+} Transfer;
+
+// The last move applied and its answer, replayed when the client
+// retransmits the move instead of taking a second step
 typedef struct {
+    int seq;           // -1 = none yet
+    int answered;      // 0: the move started a transfer, which is its answer
+    uint8_t type, size;
+    uint8_t data[2 + EXT_PATH_MAX_MOVES];  // Up to an EXT_PATH_ACK
+} MoveReply;
+
+// One client, identified by the MAC address its frames come from
+typedef struct Session {
+    struct Session *next;            // Hash chain
+    uint8_t mac[ETH_ALEN];
+    struct sockaddr_ll client_addr;  // Where responses go
     int player_x, player_y;
     Treasure treasures[MAX_TREASURES];
     int treasure_count;
-    int socket_fd;
-    struct sockaddr_ll client_addr;
     uint8_t seq_num;
-} GameState;
+    MoveReply last_move;
+    RttEstimator rtt;                // Round-trip estimate, kept across transfers
+    uint16_t ext_payload;            // Negotiated extended DATA payload (0 = standard frames)
+    uint8_t ext_check;               // ExtCheck the client asked for on extended frames
+    uint8_t ext_flags;               // ExtFlags granted to the client
+    Transfer transfer;
+    PeerStats *stats;                // This client's row in the stats table
+    long long last_seen_ms;
+    unsigned hash;
+
+    // Threaded mode: the receive thread queues frames in the inbox and
+    // schedules the session on a worker. `pending` counts queued work and
+    // stays nonzero while a worker owns the session, so it never runs on
+    // two workers at once.
+    SpscQueue inbox;
+    _Atomic int pending;
+    _Atomic int timer_kicks;           // Timer expirations not yet handled
+    _Atomic long long timer_deadline;  // Published retransmission deadline (0 = none)
+} Session;
+
+// A frame on its way from the receive thread to a session's worker
+typedef struct {
+    Packet pkt;
+    struct sockaddr_ll addr;
+} InboxFrame;
+
+typedef struct {
+    int socket_fd;
+    int epoll_fd;
+    int timer_fd;
+    int wake_fd;       // Threaded mode: workers ask the loop to re-arm the timer
+    _Atomic long long armed_deadline;  // Timer expiry in us (0 while being recomputed)
+    ArqMode arq_mode;  // Retransmission strategy for file transfers
+    int window;        // Sliding window for file transfers (1 = stop-and-wait)
+    unsigned socket_flags;  // SOCKET_* options for create_raw_socket_ex
+    int threads;       // Worker threads (0 = everything on the event loop)
+    WorkerPool *pool;
+    FrameCache cache;  // Pre-encoded treasures (budget 0 = disabled)
+    int ext_max;       // Largest extended payload we offer (0 = extension disabled)
+    int signal_fd;     // SIGUSR1: dump the stats, SIGUSR2: write the trace, SIGINT/SIGTERM: quit
+    StatsTable *stats;
+    int stats_shared;  // Table published in shared memory for statsview
+    const char *stats_path;  // Rewritten periodically (NULL = no stats file)
+    long long stats_due_us;
+    StatsSnapshot dump_snapshot, file_snapshot;
+    const char *trace_path;  // Per-frame timeline written here (NULL = no tracing)
+    const char *log_path;    // Binary event log (NULL = none)
+    Renderer *render;  // Console board (NULL = headless)
+    char treasure_files[MAX_TREASURES][512];
+    uint64_t treasure_hashes[MAX_TREASURES];  // Taken at startup, like the frame cache
+    int treasure_count;
+    Session *sessions[SESSION_BUCKETS];
+    int session_count;
+} Server;
 
 // Function prototypes
-void init_game(GameState *game);
-void display_server_state(const GameState *game);
-int find_treasure_files(GameState *game);
-int handle_movement(GameState *game, PacketType move_type);
-int send_file_to_client(GameState *game, const char *filepath, PacketType file_type);
-void process_client_packet(GameState *game, const Packet *pkt);
-void log_movement(const GameState *game, const char *direction);
-int check_treasure_discovery(GameState *game);
-int count_undiscovered(const GameState *game);
+static void run_session(void *task, void *arg);
+void init_game(const Server *server, Session *session);
+void publish_board(Server *server, const Session *session);
+int find_treasure_files(Server *server);
+void hash_treasure_files(Server *server);
+Session *find_session(Server *server, const struct sockaddr_ll *addr);
+void expire_sessions(Server *server);
+int handle_movement(Session *session, PacketType move_type);
+int start_file_transfer(Server *server, Session *session, const char *filepath,
+                        uint64_t content_hash, PacketType file_type);
+void pump_transfer(Session *session);
+void finish_transfer(Session *session, int completed);
+long long transfer_deadline(const Session *session);
+void process_client_packet(Server *server, Session *session, const Packet *pkt);
+void handle_frame(Server *server, Session *session, const Packet *pkt,
+                  const struct sockaddr_ll *addr);
+void handle_session_timer(Session *session);
+void handle_socket_event(Server *server);
+void handle_timer_event(Server *server);
+int  handle_signal_event(Server *server);
+int arm_timer(Server *server);
+void log_movement(const Session *session, PacketType move_type, int applied);
+int check_treasure_discovery(Server *server, Session *session);
+Treasure *find_treasure(Session *session);
+void discover_treasure(Server *server, Session *session, Treasure *treasure);
+int count_undiscovered(const Session *session);
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <interface>\n", argv[0]);
+    Server server = {0};
+    server.window = GBN_DEFAULT_WINDOW;
+    long cache_mb = 0;
+    int extension = 0;
+    int headless = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:m:rt:c:xes:ST:L:q")) != -1) {
+        switch (opt) {
+            case 's':
+                server.stats_path = optarg;
+                break;
+            case 'S':
+                server.stats_shared = 1;
+                break;
+            case 'T':
+                server.trace_path = optarg;
+                break;
+            case 'L':
+                server.log_path = optarg;
+                break;
+            case 'x':
+                extension = 1;
+                break;
+            case 'q':
+                headless = 1;
+                break;
+            case 'e':
+                server.socket_flags |= SOCKET_ETHERTYPE;
+                break;
+            case 'r':
+                server.socket_flags |= SOCKET_RX_RING | SOCKET_TX_RING;
+                break;
+            case 't':
+                server.threads = atoi(optarg);
+                break;
+            case 'c':
+                cache_mb = atol(optarg);
+                break;
+            case 'w':
+                server.window = atoi(optarg);
+                break;
+            case 'm':
+                if (strcmp(optarg, "gbn") == 0) {
+                    server.arq_mode = ARQ_GO_BACK_N;
+                } else if (strcmp(optarg, "sr") == 0) {
+                    server.arq_mode = ARQ_SELECTIVE_REPEAT;
+                } else {
+                    fprintf(stderr, "Unknown mode '%s' (use gbn or sr)\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-m gbn|sr] [-w window] [-r] [-t threads] [-c cache_mb] [-x] [-e] [-s stats_file] [-S] [-T trace_file] [-L log_file] [-q] <interface>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-m gbn|sr] [-w window] [-r] [-t threads] [-c cache_mb] [-x] [-e] [-s stats_file] [-S] [-T trace_file] [-L log_file] [-q] <interface>\n", argv[0]);
+        return 1;
+    }
+
+    int max_window = (server.arq_mode == ARQ_SELECTIVE_REPEAT) ? SR_MAX_WINDOW : GBN_MAX_WINDOW;
+    if (server.window < 1 || server.window > max_window) {
+        fprintf(stderr, "Window must be between 1 and %d for %s\n",
+                max_window, arq_mode_name(server.arq_mode));
+        return 1;
+    }
+    if (cache_mb < 0) {
+        fprintf(stderr, "Cache budget must not be negative\n");
         return 1;
     }
+    if (server.threads < 0 || server.threads > POOL_MAX_WORKERS) {
+        fprintf(stderr, "Threads must be between 0 and %d\n", POOL_MAX_WORKERS);
+        return 1;
+    }
+    const char *iface = argv[optind];
+
+    // Workers send concurrently, and the TX ring has a single writer
+    if (server.threads > 0) {
+        server.socket_flags &= ~SOCKET_TX_RING;
+    }
+
+    if (server.trace_path) {
+        if (trace_start(TRACE_DEFAULT_EVENTS) < 0) return 1;
+        server.socket_flags |= SOCKET_TIMESTAMPS;
+    }
 
-    GameState game = {0};
-    
     // Create raw socket
-    game.socket_fd = create_raw_socket(argv[1]);
-    if (game.socket_fd < 0) {
+    server.socket_fd = create_raw_socket_ex(iface, server.socket_flags);
+    if (server.socket_fd < 0) {
         fprintf(stderr, "Failed to create raw socket\n");
         return 1;
     }
 
-    // Get interface info
-    if (get_interface_info(game.socket_fd, argv[1], &game.client_addr) < 0) {
-        close(game.socket_fd);
+    // Extended frames must fit the link MTU
+    if (extension) {
+        int mtu = get_interface_mtu(server.socket_fd, iface);
+        if (mtu > EXT_HEADER_SIZE) {
+            server.ext_max = mtu - EXT_HEADER_SIZE;
+            if (server.ext_max > EXT_MAX_DATA_SIZE) server.ext_max = EXT_MAX_DATA_SIZE;
+        }
+    }
+
+    server.stats = stats_create(server.stats_shared);
+    if (!server.stats) {
+        close_raw_socket(server.socket_fd);
+        return 1;
+    }
+
+    // Signals arrive through a signalfd; block them before any worker
+    // starts so every thread inherits the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    // One epoll set watches the socket, the retransmission timer and signals
+    server.epoll_fd = epoll_create1(0);
+    server.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    server.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK);
+    server.wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (server.epoll_fd < 0 || server.timer_fd < 0 || server.signal_fd < 0 || server.wake_fd < 0) {
+        perror("epoll/timerfd/signalfd/eventfd");
+        close_raw_socket(server.socket_fd);
         return 1;
     }
 
-    // Initialize game
-    init_game(&game);
-    
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = server.socket_fd };
+    struct epoll_event timer_ev = { .events = EPOLLIN, .data.fd = server.timer_fd };
+    struct epoll_event signal_ev = { .events = EPOLLIN, .data.fd = server.signal_fd };
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.fd = server.wake_fd };
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.socket_fd, &ev) < 0 ||
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.timer_fd, &timer_ev) < 0 ||
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.signal_fd, &signal_ev) < 0 ||
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd, &wake_ev) < 0) {
+        perror("epoll_ctl");
+        close_raw_socket(server.socket_fd);
+        return 1;
+    }
+
+    // Every session places the same treasure files at its own positions
+    server.treasure_count = find_treasure_files(&server);
+    hash_treasure_files(&server);
+    if (server.log_path &&
+        evlog_start(server.log_path, server.treasure_files, server.treasure_count) < 0) {
+        close_raw_socket(server.socket_fd);
+        return 1;
+    }
+    srand(time(NULL));
+
+    // Encode every treasure now so discoveries need no disk I/O
+    frame_cache_init(&server.cache, (size_t)cache_mb << 20);
+    int cached = 0;
+    for (int i = 0; i < server.treasure_count && cache_mb > 0; i++) {
+        const CacheEntry *entry = frame_cache_acquire(&server.cache, server.treasure_files[i]);
+        if (entry) cached++;
+        frame_cache_release(&server.cache, entry);
+    }
+
+    if (server.threads > 0) {
+        server.pool = pool_create(server.threads, run_session, &server);
+        if (!server.pool) {
+            fprintf(stderr, "Failed to start %d worker threads\n", server.threads);
+            close_raw_socket(server.socket_fd);
+            return 1;
+        }
+    }
+
+    // The board is drawn by a thread of its own; the log scrolls beneath it
+    if (!headless) server.render = render_start(server.treasure_files);
+
     printf("=== TREASURE HUNT SERVER ===\n");
-    printf("Interface: %s\n", argv[1]);
+    printf("Interface: %s\n", iface);
+    printf("Transfer: %s, window %d%s\n", arq_mode_name(server.arq_mode), server.window,
+           (server.socket_flags & SOCKET_RX_RING) ? ", PACKET_MMAP rings" : "");
+    if (server.socket_flags & SOCKET_ETHERTYPE) {
+        printf("Framing: Ethernet header, EtherType 0x%04X\n", ETH_P_TREASURE);
+    }
+    printf("Treasures: %d\n", server.treasure_count);
+    if (server.pool) {
+        printf("Workers: %d\n", server.threads);
+    }
+    if (server.ext_max > 0) {
+        printf("Large payload extension: up to %d bytes per frame\n", server.ext_max);
+    }
+    if (cache_mb > 0) {
+        printf("Frame cache: %d treasures pre-encoded (%zu of %zu KB)\n",
+               cached, server.cache.used >> 10, server.cache.budget >> 10);
+    }
+    printf("Stats: kill -USR1 %d%s%s%s\n", getpid(),
+           server.stats_path ? ", file " : "", server.stats_path ? server.stats_path : "",
+           server.stats_shared ? ", shared memory " STATS_SHM_NAME : "");
+    if (server.trace_path) {
+        printf("Trace: %s on kill -USR2 %d and at exit\n", server.trace_path, getpid());
+    }
+    if (server.log_path) {
+        printf("Event log: %s (read it with ./logview)\n", server.log_path);
+    }
     printf("Waiting for client connections...\n\n");
-    
-    display_server_state(&game);
 
-    // Main server loop
+    // Main server loop, until SIGINT or SIGTERM
+    struct epoll_event events[MAX_EVENTS];
+    int running = 1;
+
+    while (running) {
+        // Responses queued in the TX ring go out before we sleep
+        socket_flush(server.socket_fd);
+        if (arm_timer(&server) < 0) break;
+
+        int ready = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.fd == server.socket_fd) {
+                handle_socket_event(&server);
+            } else if (events[i].data.fd == server.timer_fd) {
+                handle_timer_event(&server);
+            } else if (events[i].data.fd == server.signal_fd) {
+                if (handle_signal_event(&server) < 0) running = 0;
+            } else if (events[i].data.fd == server.wake_fd) {
+                // Only the re-arm at the top of the loop matters
+                uint64_t wakes;
+                if (read(server.wake_fd, &wakes, sizeof(wakes)) < 0 && errno != EAGAIN) {
+                    perror("eventfd read");
+                }
+            }
+        }
+    }
+
+    pool_destroy(server.pool);
+    render_stop(server.render);
+    evlog_stop();
+    if (server.trace_path) {
+        trace_write_json(server.trace_path);
+        trace_stop();
+    }
+    frame_cache_destroy(&server.cache);
+    stats_destroy(server.stats, server.stats_shared);
+    close(server.signal_fd);
+    close(server.wake_fd);
+    close(server.timer_fd);
+    close(server.epoll_fd);
+    close_raw_socket(server.socket_fd);
+    return 0;
+}
+
+// Retransmission deadline of the session's transfer (0 = nothing in flight).
+// Workers own the transfer in threaded mode, so read what they published.
+static long long session_deadline(const Server *server, Session *session) {
+    if (server->pool) {
+        return atomic_load(&session->timer_deadline);
+    }
+    return transfer_deadline(session);
+}
+
+// Neither queued work nor a transfer in progress
+static int session_idle(const Server *server, Session *session) {
+    if (server->pool) {
+        return atomic_load(&session->pending) == 0 && atomic_load(&session->timer_deadline) == 0;
+    }
+    return session->transfer.stage == XFER_IDLE;
+}
+
+// The caller has just taken the session's pending count from zero
+static void schedule_session(Server *server, Session *session) {
+    // MAX_SESSIONS keeps the run queues from filling up
+    if (pool_submit(server->pool, session, session->hash) < 0) {
+        fprintf(stderr, "Worker run queues are full\n");
+    }
+}
+
+// Threaded mode: hand the frame to whichever worker runs the session
+static void dispatch_frame(Server *server, Session *session, const Packet *pkt,
+                           const struct sockaddr_ll *addr) {
+    // Dropped frames are recovered by retransmission
+    if (spsc_full(&session->inbox)) return;
+
+    InboxFrame frame = { .pkt = *pkt, .addr = *addr };
+
+    // Count the work before queueing it, so the count never falls below
+    // what the worker has already consumed
+    int idle = atomic_fetch_add(&session->pending, 1) == 0;
+    spsc_push(&session->inbox, &frame);
+    if (idle) schedule_session(server, session);
+}
+
+// Threaded mode: the deadline passed; ask the session's worker to resend
+static void kick_session(Server *server, Session *session) {
+    // One kick per published deadline; the worker publishes the next one
+    long long deadline = atomic_load(&session->timer_deadline);
+    if (deadline == 0 || !atomic_compare_exchange_strong(&session->timer_deadline, &deadline, 0)) {
+        return;
+    }
+
+    int idle = atomic_fetch_add(&session->pending, 1) == 0;
+    atomic_fetch_add(&session->timer_kicks, 1);
+    if (idle) schedule_session(server, session);
+}
+
+// Worker: run everything queued for one session
+static void run_session(void *task, void *arg) {
+    Session *session = task;
+    Server *server = arg;
+    InboxFrame frame;
+
+    while (1) {
+        int handled = 0;
+        while (spsc_pop(&session->inbox, &frame) == 0) {
+            handle_frame(server, session, &frame.pkt, &frame.addr);
+            handled++;
+        }
+
+        int kicks = atomic_exchange(&session->timer_kicks, 0);
+        if (kicks) {
+            handle_session_timer(session);
+            handled += kicks;
+        }
+
+        long long deadline = transfer_deadline(session);
+        atomic_store(&session->timer_deadline, deadline);
+        // The loop may have armed the timer before this deadline existed;
+        // during a recompute (0) it may or may not have seen it, so wake it too
+        long long armed = atomic_load(&server->armed_deadline);
+        if (deadline != 0 && (armed == 0 || deadline < armed)) {
+            uint64_t one = 1;
+            if (write(server->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                perror("eventfd write");
+            }
+        }
+
+        // Release the session only if nothing new arrived meanwhile; after
+        // this the receive thread may free or reschedule it
+        if (atomic_fetch_sub(&session->pending, handled) == handled) break;
+    }
+}
+
+static unsigned hash_mac(const uint8_t *mac) {
+    // FNV-1a over the six address bytes
+    unsigned hash = 2166136261u;
+    for (int i = 0; i < ETH_ALEN; i++) {
+        hash = (hash ^ mac[i]) * 16777619u;
+    }
+    return hash % SESSION_BUCKETS;
+}
+
+// Session lookup without creating one on first contact
+static Session *lookup_session(Server *server, const struct sockaddr_ll *addr) {
+    unsigned bucket = hash_mac(addr->sll_addr);
+
+    for (Session *s = server->sessions[bucket]; s; s = s->next) {
+        if (memcmp(s->mac, addr->sll_addr, ETH_ALEN) == 0) return s;
+    }
+    return NULL;
+}
+
+// Counters for frames from `addr`, which may not be a client yet
+static PeerStats *sender_stats(Server *server, const struct sockaddr_ll *addr) {
+    Session *session = lookup_session(server, addr);
+    return session ? session->stats : &server->stats->other;
+}
+
+// A response sent outside the transfer window
+static void count_response(Session *session, size_t payload_size) {
+    stats_add(&session->stats->c.frames_sent, 1);
+    stats_add(&session->stats->c.bytes_sent, packet_wire_size(payload_size));
+}
+
+// Drain every frame that is ready without blocking
+void handle_socket_event(Server *server) {
+    PacketRaw frames[ARQ_RX_BATCH];
+    size_t lens[ARQ_RX_BATCH];
+    struct sockaddr_ll addrs[ARQ_RX_BATCH];
     Packet pkt;
-    struct sockaddr_ll client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    
+
     while (1) {
-        // Use direct recvfrom with proper packet unpacking
-        PacketRaw raw_pkt;
-        ssize_t received = recvfrom(game.socket_fd, &raw_pkt, sizeof(PacketRaw), 0,
-                                  (struct sockaddr *)&client_addr, &addr_len);
-        
-        if (received == sizeof(PacketRaw)) {
-            // Unpack the received packet
-            unpack_packet(&raw_pkt, &pkt);
-            
-            if (validate_packet(&pkt)) {
-                // Update client address for responses
-                game.client_addr = client_addr;
-                process_client_packet(&game, &pkt);
-                display_server_state(&game);
+        int count = socket_recv_batch(server->socket_fd, frames, sizeof(PacketRaw), lens, addrs,
+                                      ARQ_RX_BATCH);
+        if (count <= 0) return;
+
+        long long now_ms = get_timestamp_ms();
+        for (int i = 0; i < count; i++) {
+            // The spec's frames have no Ethernet header: the "source MAC" the
+            // kernel reports is payload bytes 6-11, so it says nothing about
+            // who sent the frame and every raw-framed peer is the same one
+            if (!(server->socket_flags & SOCKET_ETHERTYPE)) {
+                memset(addrs[i].sll_addr, 0, ETH_ALEN);
+            }
+
+            // Rejected frames are charged to the sender if we know it
+            if (!packet_length_ok(&frames[i], lens[i]) ||
+                frames[i].start_marker != START_MARKER) {
+                stats_add(&sender_stats(server, &addrs[i])->c.invalid_markers, 1);
+                continue;
+            }
+
+            unpack_packet(&frames[i], &pkt);
+            if (!validate_packet(&pkt)) {
+                stats_add(&sender_stats(server, &addrs[i])->c.checksum_failures, 1);
+                continue;
+            }
+
+            Session *session = find_session(server, &addrs[i]);
+            if (!session) continue;
+            session->last_seen_ms = now_ms;
+            stats_add(&session->stats->c.frames_received, 1);
+            stats_add(&session->stats->c.bytes_received, lens[i]);
+
+            if (server->pool) {
+                dispatch_frame(server, session, &pkt, &addrs[i]);
+            } else {
+                handle_frame(server, session, &pkt, &addrs[i]);
             }
         }
+
+        // A short batch means the socket is drained
+        if (count < ARQ_RX_BATCH) return;
     }
+}
+
+void handle_frame(Server *server, Session *session, const Packet *pkt,
+                  const struct sockaddr_ll *addr) {
+    long long start_ns = trace_on() ? trace_now_ns() : 0;
 
-    close(game.socket_fd);
+    // Responses go back to the address this client last used
+    session->client_addr = *addr;
+
+    if (pkt->type == PKT_ACK || pkt->type == PKT_NACK) {
+        // Late acknowledgements from a finished transfer need no answer
+        if (session->transfer.stage != XFER_IDLE) {
+            arq_handle_ack(&session->transfer.arq, pkt);
+            pump_transfer(session);
+        }
+    } else {
+        process_client_packet(server, session, pkt);
+        publish_board(server, session);
+    }
+
+    if (start_ns) {
+        trace_record(TRACE_HANDLE, start_ns, trace_now_ns(), pkt->seq, pkt->type, pkt->size, 0, 0);
+    }
+}
+
+// Resend for a transfer whose deadline has passed
+void handle_session_timer(Session *session) {
+    Transfer *t = &session->transfer;
+
+    // The client never said where to resume: send the whole file
+    if (t->stage == XFER_RESUME && t->arq.in_flight == 0 &&
+        t->resume_deadline <= get_timestamp_us()) {
+        t->stage = XFER_OFFSET;
+        pump_transfer(session);
+        return;
+    }
+
+    if (t->stage == XFER_IDLE || t->arq.in_flight == 0 || t->arq.deadline > get_timestamp_us()) {
+        return;
+    }
+
+    if (arq_handle_timeout(&t->arq) < 0) {
+        finish_transfer(session, 0);
+    } else {
+        pump_transfer(session);
+    }
+}
+
+// The timer fired: resend for every transfer whose deadline has passed
+void handle_timer_event(Server *server) {
+    uint64_t expirations;
+    if (read(server->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        perror("timerfd read");
+    }
+
+    long long now = get_timestamp_us();
+    for (int b = 0; b < SESSION_BUCKETS; b++) {
+        for (Session *s = server->sessions[b]; s; s = s->next) {
+            long long deadline = session_deadline(server, s);
+            if (deadline == 0 || deadline > now) continue;
+
+            if (server->pool) {
+                kick_session(server, s);
+            } else {
+                handle_session_timer(s);
+            }
+        }
+    }
+
+    expire_sessions(server);
+
+    if (server->stats_path && now >= server->stats_due_us) {
+        stats_write_file(server->stats, server->stats_path, &server->file_snapshot);
+        server->stats_due_us = now + STATS_FILE_PERIOD_US;
+    }
+}
+
+// SIGUSR1: print every peer's counters; SIGUSR2: write the trace so far.
+// Returns -1 when asked to quit.
+int handle_signal_event(Server *server) {
+    struct signalfd_siginfo info;
+    int quit = 0;
+    while (read(server->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGUSR1) {
+            flockfile(stdout);
+            stats_dump(server->stats, stdout, &server->dump_snapshot);
+            funlockfile(stdout);
+        } else if (info.ssi_signo == SIGUSR2) {
+            if (server->trace_path) trace_write_json(server->trace_path);
+        } else {
+            quit = 1;
+        }
+    }
+    return quit ? -1 : 0;
+}
+
+// Arm the timer for the earliest retransmission deadline of any session
+int arm_timer(Server *server) {
+    long long deadline = get_timestamp_us() + HOUSEKEEPING_US;
+
+    atomic_store(&server->armed_deadline, 0);
+    for (int b = 0; b < SESSION_BUCKETS; b++) {
+        for (Session *s = server->sessions[b]; s; s = s->next) {
+            long long session_due = session_deadline(server, s);
+            if (session_due != 0 && session_due < deadline) {
+                deadline = session_due;
+            }
+        }
+    }
+
+    // An absolute time in the past fires immediately, which is what we want
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = deadline / 1000000;
+    its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+        its.it_value.tv_nsec = 1;  // Zero would disarm the timer
+    }
+
+    if (timerfd_settime(server->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        return -1;
+    }
+    atomic_store(&server->armed_deadline, deadline);
     return 0;
 }
 
-void init_game(GameState *game) {
+// Look up the session for a sender, creating it on first contact
+Session *find_session(Server *server, const struct sockaddr_ll *addr) {
+    Session *existing = lookup_session(server, addr);
+    if (existing) return existing;
+
+    unsigned bucket = hash_mac(addr->sll_addr);
+    if (server->session_count >= MAX_SESSIONS) return NULL;
+
+    Session *session = calloc(1, sizeof(Session));
+    if (!session) {
+        perror("calloc");
+        return NULL;
+    }
+    if (server->pool && spsc_init(&session->inbox, SESSION_INBOX_SIZE, sizeof(InboxFrame)) < 0) {
+        free(session);
+        return NULL;
+    }
+
+    memcpy(session->mac, addr->sll_addr, ETH_ALEN);
+    session->hash = bucket;
+    session->stats = stats_attach(server->stats, session->mac);
+    session->client_addr = *addr;
+    init_game(server, session);
+
+    session->next = server->sessions[bucket];
+    server->sessions[bucket] = session;
+    server->session_count++;
+
+    printf("New client %02x:%02x:%02x:%02x:%02x:%02x (%d active)\n",
+           session->mac[0], session->mac[1], session->mac[2],
+           session->mac[3], session->mac[4], session->mac[5], server->session_count);
+    return session;
+}
+
+// Drop sessions that have been silent for a long time and are not transferring
+void expire_sessions(Server *server) {
+    long long now = get_timestamp_ms();
+
+    for (int b = 0; b < SESSION_BUCKETS; b++) {
+        Session **link = &server->sessions[b];
+        while (*link) {
+            Session *s = *link;
+            if (session_idle(server, s) && now - s->last_seen_ms > SESSION_IDLE_MS) {
+                *link = s->next;
+                server->session_count--;
+                stats_detach(server->stats, s->stats);
+                spsc_destroy(&s->inbox);
+                free(s);
+            } else {
+                link = &s->next;
+            }
+        }
+    }
+}
+
+void init_game(const Server *server, Session *session) {
     // Initialize player position at bottom-left (0,0)
-    game->player_x = 0;
-    game->player_y = 0;
-    game->seq_num = 0;
-    
-    // Find treasure files
-    game->treasure_count = find_treasure_files(game);
-    
+    session->player_x = 0;
+    session->player_y = 0;
+    session->seq_num = 0;
+    session->ext_payload = 0;
+    session->ext_check = EXT_CHECK_XOR;
+    session->ext_flags = 0;
+    session->last_move.seq = -1;
+    session->last_seen_ms = get_timestamp_ms();
+    rtt_init(&session->rtt);
+
+    session->treasure_count = server->treasure_count;
+
     // Randomly place treasures on the grid
-    srand(time(NULL));
-    for (int i = 0; i < game->treasure_count; i++) {
+    for (int i = 0; i < session->treasure_count; i++) {
+        strcpy(session->treasures[i].filename, server->treasure_files[i]);
+        session->treasures[i].hash = server->treasure_hashes[i];
+
         int placed = 0;
         while (!placed) {
             int x = rand() % GRID_SIZE;
             int y = rand() % GRID_SIZE;
-            
+
             // Check if position is already occupied
             int occupied = 0;
             for (int j = 0; j < i; j++) {
-                if (game->treasures[j].x == x && game->treasures[j].y == y) {
+                if (session->treasures[j].x == x && session->treasures[j].y == y) {
                     occupied = 1;
                     break;
                 }
             }
-            
+
             if (!occupied) {
-                game->treasures[i].x = x;
-                game->treasures[i].y = y;
-                game->treasures[i].discovered = 0;
+                session->treasures[i].x = x;
+                session->treasures[i].y = y;
+                session->treasures[i].discovered = 0;
                 placed = 1;
             }
         }
     }
 }
 
-int find_treasure_files(GameState *game) {
+int find_treasure_files(Server *server) {
     DIR *dir = opendir(OBJECTS_DIR);
     if (!dir) {
         printf("Warning: Could not open %s directory\n", OBJECTS_DIR);
@@ -140,134 +829,263 @@ int find_treasure_files(GameState *game) {
 
     struct dirent *entry;
     int count = 0;
-    
+
     while ((entry = readdir(dir)) != NULL && count < MAX_TREASURES) {
         // Check if filename matches pattern: digit 1-8 followed by a dot (1.xxx to 8.xxx)
-        if (entry->d_name[0] >= '1' && entry->d_name[0] <= '8' && 
+        if (entry->d_name[0] >= '1' && entry->d_name[0] <= '8' &&
             entry->d_name[1] == '.' && strlen(entry->d_name) > 2) {
-            snprintf(game->treasures[count].filename, sizeof(game->treasures[count].filename),
+            snprintf(server->treasure_files[count], sizeof(server->treasure_files[count]),
                     "%s/%s", OBJECTS_DIR, entry->d_name);
             count++;
         }
     }
-    
+
     closedir(dir);
     return count;
 }
 
-void display_server_state(const GameState *game) {
-    printf("\n=== SERVER STATE ===\n");
-    printf("Player position: (%d, %d)\n", game->player_x, game->player_y);
-    printf("Treasures found: %d/%d\n", 
-           game->treasure_count - count_undiscovered(game), game->treasure_count);
-    
-    printf("\nGrid (P=Player, T=Treasure, D=Discovered, .=Empty):\n");
-    printf("  ");
-    for (int x = 0; x < GRID_SIZE; x++) printf("%d ", x);
-    printf("\n");
-    
-    for (int y = GRID_SIZE - 1; y >= 0; y--) {
-        printf("%d ", y);
-        for (int x = 0; x < GRID_SIZE; x++) {
-            char cell = '.';
-            
-            // Check if player is here
-            if (game->player_x == x && game->player_y == y) {
-                cell = 'P';
-            } else {
-                // Check for treasures
-                for (int i = 0; i < game->treasure_count; i++) {
-                    if (game->treasures[i].x == x && game->treasures[i].y == y) {
-                        cell = game->treasures[i].discovered ? 'D' : 'T';
-                        break;
-                    }
-                }
-            }
-            printf("%c ", cell);
+// Clients that already hold a treasure recognise it by this hash
+void hash_treasure_files(Server *server) {
+    for (int i = 0; i < server->treasure_count; i++) {
+        FileSource src;
+        server->treasure_hashes[i] = 0;
+        if (file_source_open(&src, server->treasure_files[i]) == 0) {
+            server->treasure_hashes[i] = xxh64(src.data, src.size, 0);
+            file_source_close(&src);
         }
-        printf("\n");
     }
-    
-    printf("\nTreasure locations:\n");
-    for (int i = 0; i < game->treasure_count; i++) {
-        printf("  %s at (%d,%d) - %s\n",
-               game->treasures[i].filename,
-               game->treasures[i].x, game->treasures[i].y,
-               game->treasures[i].discovered ? "DISCOVERED" : "hidden");
+}
+
+// Hand the renderer a copy of the board; drawing it is not our business
+void publish_board(Server *server, const Session *session) {
+    if (!server->render) return;
+
+    BoardView view;
+    memcpy(view.mac, session->mac, ETH_ALEN);
+    view.player_x = session->player_x;
+    view.player_y = session->player_y;
+    view.treasure_count = session->treasure_count;
+    for (int i = 0; i < session->treasure_count; i++) {
+        view.treasures[i].x = session->treasures[i].x;
+        view.treasures[i].y = session->treasures[i].y;
+        view.treasures[i].discovered = session->treasures[i].discovered;
     }
-    printf("========================\n\n");
+    render_publish(server->render, &view);
 }
 
-int count_undiscovered(const GameState *game) {
+int count_undiscovered(const Session *session) {
     int count = 0;
-    for (int i = 0; i < game->treasure_count; i++) {
-        if (!game->treasures[i].discovered) count++;
+    for (int i = 0; i < session->treasure_count; i++) {
+        if (!session->treasures[i].discovered) count++;
     }
     return count;
 }
 
-void process_client_packet(GameState *game, const Packet *pkt) {
-    switch (pkt->type) {
-        case PKT_MOVE_RIGHT:
-            if (handle_movement(game, PKT_MOVE_RIGHT)) {
-                log_movement(game, "RIGHT");
-                // Check for treasure first, then send appropriate response
-                int treasure_found = check_treasure_discovery(game);
-                if (!treasure_found) {
-                    send_ack_with_position(game->socket_fd, &game->client_addr, PKT_OK_ACK, game->player_x, game->player_y);
-                }
-            } else {
-                send_error(game->socket_fd, &game->client_addr, ERR_NO_PERMISSION);
-            }
-            break;
-            
-        case PKT_MOVE_LEFT:
-            if (handle_movement(game, PKT_MOVE_LEFT)) {
-                log_movement(game, "LEFT");
-                int treasure_found = check_treasure_discovery(game);
-                if (!treasure_found) {
-                    send_ack_with_position(game->socket_fd, &game->client_addr, PKT_OK_ACK, game->player_x, game->player_y);
-                }
-            } else {
-                send_error(game->socket_fd, &game->client_addr, ERR_NO_PERMISSION);
-            }
-            break;
-            
-        case PKT_MOVE_UP:
-            if (handle_movement(game, PKT_MOVE_UP)) {
-                log_movement(game, "UP");
-                int treasure_found = check_treasure_discovery(game);
-                if (!treasure_found) {
-                    send_ack_with_position(game->socket_fd, &game->client_addr, PKT_OK_ACK, game->player_x, game->player_y);
-                }
-            } else {
-                send_error(game->socket_fd, &game->client_addr, ERR_NO_PERMISSION);
-            }
-            break;
-            
-        case PKT_MOVE_DOWN:
-            if (handle_movement(game, PKT_MOVE_DOWN)) {
-                log_movement(game, "DOWN");
-                int treasure_found = check_treasure_discovery(game);
-                if (!treasure_found) {
-                    send_ack_with_position(game->socket_fd, &game->client_addr, PKT_OK_ACK, game->player_x, game->player_y);
-                }
-            } else {
-                send_error(game->socket_fd, &game->client_addr, ERR_NO_PERMISSION);
-            }
-            break;
-            
-        default:
-            printf("Received unknown packet type: %d\n", pkt->type);
-            send_ack(game->socket_fd, &game->client_addr, PKT_NACK);
-            break;
+// Pick up the transfer at the offset the client asked for, if the bytes it
+// holds hash the same as ours; anything else starts over at byte 0. A client
+// claiming the whole file by its content hash gets only the end of file.
+static void handle_resume(Session *session, const Packet *pkt) {
+    Transfer *t = &session->transfer;
+    if (t->stage != XFER_RESUME) return;  // Repeated request: already answered
+
+    uint32_t offset;
+    uint64_t hash = 0;
+    memcpy(&offset, pkt->data + 1, sizeof(offset));
+    offset = ntohl(offset);
+    for (int i = 0; i < 8; i++) {
+        hash = (hash << 8) | pkt->data[5 + i];
+    }
+
+    if (offset > t->file_size) offset = 0;
+    int whole = (session->ext_flags & EXT_FLAG_HASH) && offset > 0 &&
+                offset == t->file_size && hash == t->content_hash;
+
+    // Cached frames cannot start mid-frame, and the hash needs the bytes
+    if (offset > 0 && !whole && t->cached) {
+        if (file_source_open(&t->source, t->filepath) == 0) {
+            frame_cache_release(t->cache, t->cached);
+            t->cached = NULL;
+        } else {
+            offset = 0;
+        }
+    }
+    if (offset > 0 && !whole && xxh64(t->source.data, offset, 0) != hash) {
+        printf("Resume of %s at %u rejected: client data differs\n", t->filepath, offset);
+        offset = 0;
+    }
+
+    if (whole) {
+        printf("Client already has %s\n", t->filepath);
+    } else if (offset > 0) {
+        printf("Resuming %s at %u of %zu bytes\n", t->filepath, offset, t->file_size);
+    }
+    t->resume_offset = offset;
+    t->total_sent = offset;
+    t->stage = XFER_OFFSET;
+    pump_transfer(session);
+}
+
+// Answer a move with its own sequence number, keeping the answer for a
+// retransmission of the move
+static void answer_move(Server *server, Session *session, uint8_t type,
+                        const uint8_t *data, uint8_t size) {
+    MoveReply *reply = &session->last_move;
+    reply->answered = 1;
+    reply->type = type;
+    reply->size = size;
+    memcpy(reply->data, data, size);
+
+    Packet pkt = {
+        .start_marker = START_MARKER,
+        .size = size,
+        .seq = reply->seq,
+        .type = type
+    };
+    memcpy(pkt.data, data, size);
+    send_frame(server->socket_fd, &pkt, &session->client_addr);
+    count_response(session, size);
+}
+
+static const char *move_name(uint8_t type) {
+    switch (type) {
+        case PKT_MOVE_RIGHT: return "RIGHT";
+        case PKT_MOVE_LEFT:  return "LEFT";
+        case PKT_MOVE_UP:    return "UP";
+        case PKT_MOVE_DOWN:  return "DOWN";
+        default:             return NULL;
+    }
+}
+
+// Moves wait while a transfer runs (the client sends them again after it),
+// and a retransmitted move gets its first answer again instead of a second
+// step. Returns 1 when the move must not be applied.
+static int move_seen(Server *server, Session *session, uint8_t seq) {
+    if (session->transfer.stage != XFER_IDLE) return 1;
+
+    MoveReply *reply = &session->last_move;
+    if (seq == reply->seq) {
+        if (reply->answered) answer_move(server, session, reply->type, reply->data, reply->size);
+        return 1;
+    }
+    reply->seq = seq;
+    reply->answered = 0;
+    return 0;
+}
+
+// Apply a path of moves in order, up to the first treasure. The answer goes
+// out before that treasure's transfer starts, so it arrives first.
+static void handle_path(Server *server, Session *session, const Packet *pkt) {
+    if (move_seen(server, session, pkt->seq)) return;
+
+    uint8_t answer[2 + EXT_PATH_MAX_MOVES] = { EXT_PATH_ACK };
+    int moves = pkt->size - 1;
+    int applied = 0;
+    Treasure *found = NULL;
+
+    while (applied < moves && !found) {
+        uint8_t type = pkt->data[1 + applied];
+        if (handle_movement(session, type)) {
+            log_movement(session, type, 1);
+            answer[2 + applied] = (session->player_x << 4) | session->player_y;
+            found = find_treasure(session);
+        } else {
+            log_movement(session, type, 0);
+            answer[2 + applied] = PATH_REFUSED;
+        }
+        applied++;
+    }
+
+    answer[1] = applied | (found ? PATH_FILE_FOLLOWS : 0);
+    answer_move(server, session, PKT_EXTENSION, answer, 2 + applied);
+    if (found) discover_treasure(server, session, found);
+}
+
+// Agree on the extended payload size: the smaller of the two offers (none
+// without -x). The checksum is whichever the client asked for, and the
+// flags those both ends know (older clients send no data[3] or data[4]).
+static int handle_extension(Server *server, Session *session, const Packet *pkt) {
+    if (pkt->size >= EXT_RESUME_SIZE && pkt->data[0] == EXT_RESUME) {
+        handle_resume(session, pkt);
+        return 0;
+    }
+    if (pkt->size >= 2 && pkt->data[0] == EXT_PATH && pkt->size - 1 <= EXT_PATH_MAX_MOVES) {
+        handle_path(server, session, pkt);
+        return 0;
+    }
+    if (pkt->size < 3 || pkt->data[0] != EXT_HELLO) return -1;
+
+    int offer = (pkt->data[1] << 8) | pkt->data[2];
+    if (offer > server->ext_max) offer = server->ext_max;
+    // Below a standard frame's payload the extension gains nothing
+    if (offer <= MAX_DATA_SIZE) offer = 0;
+
+    uint8_t check = pkt->size >= 4 && pkt->data[3] == EXT_CHECK_CRC8 ? EXT_CHECK_CRC8
+                                                                     : EXT_CHECK_XOR;
+    uint8_t flags = pkt->size >= 5 ? pkt->data[4] & (EXT_FLAG_RESUME | EXT_FLAG_HASH | EXT_FLAG_PATH)
+                                   : 0;
+
+    // A hello starts a new client: its move numbers start over
+    session->last_move.seq = -1;
+
+    // A transfer in progress keeps the frame format it started with
+    if (session->transfer.stage == XFER_IDLE) {
+        session->ext_payload = offer;
+        session->ext_check = offer ? check : EXT_CHECK_XOR;
+        session->ext_flags = flags;
     }
+
+    Packet reply = {
+        .start_marker = START_MARKER,
+        .size = 5,
+        .seq = pkt->seq,
+        .type = PKT_EXTENSION,
+        .data = { EXT_HELLO_ACK, session->ext_payload >> 8, session->ext_payload & 0xFF,
+                  session->ext_check, session->ext_flags }
+    };
+    send_frame(server->socket_fd, &reply, &session->client_addr);
+    count_response(session, reply.size);
+    printf("Client negotiated %s frames (%d byte payload%s)%s%s%s\n",
+           session->ext_payload ? "extended" : "standard",
+           session->ext_payload ? session->ext_payload : MAX_DATA_SIZE,
+           session->ext_check == EXT_CHECK_CRC8 ? ", CRC-8" : "",
+           (session->ext_flags & EXT_FLAG_RESUME) ? ", resumable transfers" : "",
+           (session->ext_flags & EXT_FLAG_HASH) ? ", content hashes" : "",
+           (session->ext_flags & EXT_FLAG_PATH) ? ", move paths" : "");
+    return 0;
 }
 
-int handle_movement(GameState *game, PacketType move_type) {
-    int new_x = game->player_x;
-    int new_y = game->player_y;
-    
+void process_client_packet(Server *server, Session *session, const Packet *pkt) {
+    const char *direction = move_name(pkt->type);
+
+    if (pkt->type == PKT_EXTENSION && handle_extension(server, session, pkt) == 0) return;
+    if (!direction) {
+        printf("Received unknown packet type: %d\n", pkt->type);
+        send_ack(server->socket_fd, &session->client_addr, PKT_NACK);
+        count_response(session, 0);
+        return;
+    }
+
+    if (move_seen(server, session, pkt->seq)) return;
+
+    if (handle_movement(session, pkt->type)) {
+        log_movement(session, pkt->type, 1);
+        // Check for treasure first, then send appropriate response
+        int treasure_found = check_treasure_discovery(server, session);
+        if (!treasure_found) {
+            uint8_t position[2] = { session->player_x, session->player_y };
+            answer_move(server, session, PKT_OK_ACK, position, sizeof(position));
+        }
+    } else {
+        uint8_t code = ERR_NO_PERMISSION;
+        log_movement(session, pkt->type, 0);
+        answer_move(server, session, PKT_ERROR, &code, 1);
+    }
+}
+
+int handle_movement(Session *session, PacketType move_type) {
+    int new_x = session->player_x;
+    int new_y = session->player_y;
+
     switch (move_type) {
         case PKT_MOVE_RIGHT: new_x++; break;
         case PKT_MOVE_LEFT:  new_x--; break;
@@ -275,154 +1093,272 @@ int handle_movement(GameState *game, PacketType move_type) {
         case PKT_MOVE_DOWN:  new_y--; break;
         default: return 0;
     }
-    
+
     // Check bounds
     if (new_x < 0 || new_x >= GRID_SIZE || new_y < 0 || new_y >= GRID_SIZE) {
         return 0; // Invalid move
     }
-    
+
     // Update position
-    game->player_x = new_x;
-    game->player_y = new_y;
+    session->player_x = new_x;
+    session->player_y = new_y;
     return 1; // Valid move
 }
 
-int check_treasure_discovery(GameState *game) {
-    for (int i = 0; i < game->treasure_count; i++) {
-        if (game->treasures[i].x == game->player_x && 
-            game->treasures[i].y == game->player_y && 
-            !game->treasures[i].discovered) {
-            
-            game->treasures[i].discovered = 1;
-            printf("TREASURE DISCOVERED at (%d,%d): %s\n", 
-                   game->player_x, game->player_y, game->treasures[i].filename);
-            
-            // Determine file type and send
-            PacketType file_type = PKT_TEXT_ACK;
-            if (strstr(game->treasures[i].filename, ".jpg") || 
-                strstr(game->treasures[i].filename, ".jpeg")) {
-                file_type = PKT_IMAGE_ACK;
-            } else if (strstr(game->treasures[i].filename, ".mp4")) {
-                file_type = PKT_VIDEO_ACK;
-            } else if (strstr(game->treasures[i].filename, ".mp3") ||
-                      strstr(game->treasures[i].filename, ".wav") ||
-                      strstr(game->treasures[i].filename, ".ogg")) {
-                file_type = PKT_VIDEO_ACK; // Use VIDEO_ACK for audio files too
-            }
-            
-            send_file_to_client(game, game->treasures[i].filename, file_type);
-            return 1; // Treasure found
+// The undiscovered treasure under the player, if any
+Treasure *find_treasure(Session *session) {
+    for (int i = 0; i < session->treasure_count; i++) {
+        Treasure *treasure = &session->treasures[i];
+        if (treasure->x == session->player_x &&
+            treasure->y == session->player_y &&
+            !treasure->discovered) {
+            return treasure;
         }
     }
-    return 0; // No treasure found
+    return NULL;
+}
+
+void discover_treasure(Server *server, Session *session, Treasure *treasure) {
+    treasure->discovered = 1;
+    printf("TREASURE DISCOVERED at (%d,%d): %s\n",
+           session->player_x, session->player_y, treasure->filename);
+    session->transfer.treasure = treasure - session->treasures;
+    if (evlog_on()) {
+        evlog_record(EV_DISCOVER, session->mac, 0, session->player_x, session->player_y,
+                     session->transfer.treasure, 0, 0);
+    }
+
+    // Determine file type and send
+    PacketType file_type = PKT_TEXT_ACK;
+    if (strstr(treasure->filename, ".jpg") ||
+        strstr(treasure->filename, ".jpeg")) {
+        file_type = PKT_IMAGE_ACK;
+    } else if (strstr(treasure->filename, ".mp4")) {
+        file_type = PKT_VIDEO_ACK;
+    } else if (strstr(treasure->filename, ".mp3") ||
+              strstr(treasure->filename, ".wav") ||
+              strstr(treasure->filename, ".ogg")) {
+        file_type = PKT_VIDEO_ACK; // Use VIDEO_ACK for audio files too
+    }
+
+    start_file_transfer(server, session, treasure->filename, treasure->hash, file_type);
+}
+
+int check_treasure_discovery(Server *server, Session *session) {
+    Treasure *treasure = find_treasure(session);
+    if (!treasure) return 0; // No treasure found
+
+    discover_treasure(server, session, treasure);
+    return 1; // Treasure found
 }
 
-int send_file_to_client(GameState *game, const char *filepath, PacketType file_type) {
-    FILE *file = fopen(filepath, "rb");
-    if (!file) {
+// Open the file and send the first window; ACKs and timer events do the rest
+int start_file_transfer(Server *server, Session *session, const char *filepath,
+                        uint64_t content_hash, PacketType file_type) {
+    Transfer *t = &session->transfer;
+
+    // Pre-encoded frames when the cache holds the file, the mapping otherwise
+    // The cache holds standard frames only, so extended transfers skip it
+    t->cache = &server->cache;
+    t->cached = session->ext_payload ? NULL : frame_cache_acquire(&server->cache, filepath);
+    if (t->cached) {
+        t->file_size = t->cached->size;
+    } else if (file_source_open(&t->source, filepath) == 0) {
+        t->file_size = t->source.size;
+    } else {
         printf("Error: Could not open file %s\n", filepath);
-        send_error(game->socket_fd, &game->client_addr, ERR_NO_PERMISSION);
+        send_error(server->socket_fd, &session->client_addr, ERR_NO_PERMISSION);
+        count_response(session, 1);
         return -1;
     }
-    
-    // Get file size
-    struct stat st;
-    if (stat(filepath, &st) < 0) {
-        fclose(file);
-        send_error(game->socket_fd, &game->client_addr, ERR_NO_PERMISSION);
-        return -1;
+
+    printf("Sending file: %s (%zu bytes, window %d%s)\n", filepath, t->file_size, server->window,
+           t->cached ? ", cached" : "");
+    if (evlog_on()) {
+        evlog_record(EV_TRANSFER_START, session->mac, t->cached != NULL, session->player_x,
+                     session->player_y, t->treasure, t->file_size, 0);
     }
-    
-    printf("Sending file: %s (%ld bytes)\n", filepath, st.st_size);
-    
-    // Send file size using proper stop-and-wait
-    Packet size_pkt = {
-        .start_marker = START_MARKER,
-        .size = sizeof(uint32_t) + 2, // Add 2 for coordinates
-        .seq = (game->seq_num++) & 0x1F,
-        .type = PKT_SIZE
-    };
-    uint32_t file_size = htonl(st.st_size);
-    memcpy(size_pkt.data, &file_size, sizeof(uint32_t));
-    size_pkt.data[sizeof(uint32_t)] = game->player_x;
-    size_pkt.data[sizeof(uint32_t) + 1] = game->player_y;
-    size_pkt.checksum = calculate_crc(&size_pkt);
-    
-    if (send_packet(game->socket_fd, &size_pkt, &game->client_addr) < 0) {
-        fclose(file);
-        return -1;
+
+    // Size, name, data and end-of-file frames all share one sliding window
+    snprintf(t->filepath, sizeof(t->filepath), "%s", filepath);
+    t->file_type = file_type;
+    t->content_hash = content_hash;
+    t->total_sent = 0;
+    t->resume_offset = 0;
+    t->stage = XFER_SIZE;
+    arq_sender_init(&t->arq, server->socket_fd, &session->client_addr, server->arq_mode,
+                    server->window, session->seq_num, &session->rtt);
+    t->arq.stats = session->stats;
+
+    pump_transfer(session);
+    return 0;
+}
+
+// Fill the window with the next frames of the transfer
+void pump_transfer(Session *session) {
+    Transfer *t = &session->transfer;
+
+    while (t->stage != XFER_IDLE && t->stage != XFER_RESUME && t->stage != XFER_DRAIN &&
+           !arq_window_full(&t->arq)) {
+        Packet pkt = { .start_marker = START_MARKER };
+
+        switch (t->stage) {
+            case XFER_SIZE: {
+                // File size followed by the coordinates and, if asked for, the hash
+                uint32_t file_size = htonl(t->file_size);
+                pkt.type = PKT_SIZE;
+                pkt.size = sizeof(uint32_t) + 2;
+                memcpy(pkt.data, &file_size, sizeof(uint32_t));
+                pkt.data[sizeof(uint32_t)] = session->player_x;
+                pkt.data[sizeof(uint32_t) + 1] = session->player_y;
+                if (session->ext_flags & EXT_FLAG_HASH) {
+                    for (int i = 0; i < 8; i++) {
+                        pkt.data[pkt.size++] = t->content_hash >> (56 - 8 * i);
+                    }
+                }
+                t->stage = XFER_NAME;
+                break;
+            }
+
+            case XFER_NAME: {
+                // Filename with the file type
+                const char *filename = strrchr(t->filepath, '/');
+                filename = filename ? filename + 1 : t->filepath;
+                pkt.type = t->file_type;
+                pkt.size = strlen(filename);
+                memcpy(pkt.data, filename, pkt.size);
+                t->stage = XFER_DATA;
+
+                // A client that can resume says how much it already has
+                if (session->ext_flags & EXT_FLAG_RESUME) {
+                    t->stage = XFER_RESUME;
+                    t->resume_deadline = get_timestamp_us() + RESUME_WAIT_US;
+                }
+                break;
+            }
+
+            case XFER_OFFSET: {
+                uint32_t offset = htonl(t->resume_offset);
+                pkt.type = PKT_EXTENSION;
+                pkt.size = EXT_RESUME_ACK_SIZE;
+                pkt.data[0] = EXT_RESUME_ACK;
+                memcpy(pkt.data + 1, &offset, sizeof(offset));
+                t->stage = XFER_DATA;
+                break;
+            }
+
+            case XFER_DATA: {
+                size_t remaining = t->file_size - t->total_sent;
+                if (remaining == 0) {
+                    t->stage = XFER_EOF;
+                    continue;
+                }
+
+                // Checksum and payload were prepared at startup; only the seq is new
+                if (t->cached) {
+                    const PacketRaw *frame = &t->cached->frames[t->total_sent / MAX_DATA_SIZE];
+                    arq_transmit_encoded(&t->arq, frame);
+                    t->total_sent += frame->size_seq_type >> 1;
+                    continue;
+                }
+
+                // Negotiated extended frames carry more of the mapping each
+                if (session->ext_payload) {
+                    uint16_t chunk = remaining < session->ext_payload ? remaining
+                                                                      : session->ext_payload;
+                    uint8_t type = PKT_DATA;
+                    if (session->ext_check == EXT_CHECK_CRC8) type |= EXT_TYPE_CRC8;
+                    arq_transmit_ext(&t->arq, type, t->source.data + t->total_sent, chunk);
+                    t->total_sent += chunk;
+                    continue;
+                }
+
+                // The payload stays in the mapping until it is acknowledged
+                pkt.type = PKT_DATA;
+                pkt.size = remaining < MAX_DATA_SIZE ? remaining : MAX_DATA_SIZE;
+                arq_transmit_ref(&t->arq, &pkt, t->source.data + t->total_sent);
+                t->total_sent += pkt.size;
+                continue;
+            }
+
+            default:  // XFER_EOF
+                pkt.type = PKT_END_FILE;
+                pkt.size = 0;
+                t->stage = XFER_DRAIN;
+                break;
+        }
+
+        arq_transmit(&t->arq, &pkt);
     }
-    
-    // Send filename with file type using proper stop-and-wait
-    const char *filename = strrchr(filepath, '/');
-    filename = filename ? filename + 1 : filepath;
-    
-    Packet name_pkt = {
-        .start_marker = START_MARKER,
-        .size = strlen(filename),
-        .seq = (game->seq_num++) & 0x1F,
-        .type = file_type
-    };
-    strcpy((char*)name_pkt.data, filename);
-    name_pkt.checksum = calculate_crc(&name_pkt);
-    
-    if (send_packet(game->socket_fd, &name_pkt, &game->client_addr) < 0) {
-        fclose(file);
-        return -1;
+
+    // Everything the window allowed goes out in one batch
+    arq_transmit_pending(&t->arq);
+
+    if (t->stage == XFER_DRAIN && t->arq.in_flight == 0) {
+        finish_transfer(session, 1);
+    }
+}
+
+long long transfer_deadline(const Session *session) {
+    const Transfer *t = &session->transfer;
+    if (t->stage == XFER_RESUME && t->arq.in_flight == 0) return t->resume_deadline;
+    if (t->stage == XFER_IDLE || t->arq.in_flight == 0) return 0;
+    return t->arq.deadline;
+}
+
+void finish_transfer(Session *session, int completed) {
+    Transfer *t = &session->transfer;
+    TransferStage stage = t->stage;
+
+    session->seq_num = t->arq.next_seq;
+    if (t->cached) {
+        frame_cache_release(t->cache, t->cached);
+        t->cached = NULL;
+    } else {
+        file_source_close(&t->source);
     }
-    
-    // Send file data in chunks using proper stop-and-wait
-    uint8_t buffer[MAX_DATA_SIZE];
-    size_t bytes_read;
-    size_t total_sent = 0;
-    
-    while ((bytes_read = fread(buffer, 1, MAX_DATA_SIZE, file)) > 0) {
-        Packet data_pkt = {
-            .start_marker = START_MARKER,
-            .size = bytes_read,
-            .seq = (game->seq_num++) & 0x1F,
-            .type = PKT_DATA
-        };
-        memcpy(data_pkt.data, buffer, bytes_read);
-        data_pkt.checksum = calculate_crc(&data_pkt);
-        
-        if (send_packet(game->socket_fd, &data_pkt, &game->client_addr) < 0) {
-            printf("Failed to send data packet at offset %zu\n", total_sent);
-            fclose(file);
-            return -1;
+    t->stage = XFER_IDLE;
+    if (evlog_on()) {
+        evlog_record(EV_TRANSFER_END, session->mac, completed, session->player_x,
+                     session->player_y, t->treasure, t->total_sent,
+                     t->total_sent - t->resume_offset);
+    }
+
+    if (completed) {
+        printf("File transfer completed: %s (%zu bytes, %zu sent, srtt %lld us, rto %lld us)\n",
+               t->filepath, t->total_sent, t->total_sent - t->resume_offset,
+               session->rtt.srtt_us, rtt_timeout_us(&session->rtt));
+    } else {
+        printf("File transfer failed: %s at offset %zu\n", t->filepath, t->total_sent);
+
+        // Hide the treasure again, so stepping on it resumes the transfer.
+        // Once the end of file went out, only its ACK may have been lost:
+        // the client likely holds the file, so it stays discovered.
+        if (stage == XFER_DRAIN) return;
+        for (int i = 0; i < session->treasure_count; i++) {
+            if (strcmp(session->treasures[i].filename, t->filepath) == 0) {
+                session->treasures[i].discovered = 0;
+            }
         }
-        
-        total_sent += bytes_read;
-        printf("Sent %zu/%ld bytes (seq: %d)\r", total_sent, st.st_size, data_pkt.seq);
-        fflush(stdout);
-    }
-    
-    // Send end of file using proper stop-and-wait
-    Packet eof_pkt = {
-        .start_marker = START_MARKER,
-        .size = 0,
-        .seq = (game->seq_num++) & 0x1F,
-        .type = PKT_END_FILE
-    };
-    eof_pkt.checksum = calculate_crc(&eof_pkt);
-    
-    if (send_packet(game->socket_fd, &eof_pkt, &game->client_addr) < 0) {
-        printf("Failed to send end-of-file packet\n");
-        fclose(file);
-        return -1;
     }
-    
-    fclose(file);
-    printf("\nFile transfer completed: %s\n", filepath);
-    return 0;
 }
 
-void log_movement(const GameState *game, const char *direction) {
+// With -L every move, refused ones included, goes to the event log;
+// without it, applied moves are printed as before
+void log_movement(const Session *session, PacketType move_type, int applied) {
+    if (evlog_on()) {
+        evlog_record(EV_MOVE, session->mac, move_type, session->player_x, session->player_y,
+                     0, applied, 0);
+        return;
+    }
+    if (!applied) return;
+
     time_t now;
+    char time_str[32];
     time(&now);
-    char *time_str = ctime(&now);
+    ctime_r(&now, time_str);  // Workers log concurrently
     time_str[strlen(time_str) - 1] = '\0'; // Remove newline
-    
-    printf("[%s] Player moved %s to (%d,%d)\n", 
-           time_str, direction, game->player_x, game->player_y);
-}
\ No newline at end of file
+
+    printf("[%s] Player moved %s to (%d,%d)\n",
+           time_str, move_name(move_type), session->player_x, session->player_y);
+}
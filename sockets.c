@@ -1,30 +1,214 @@
 #include "sockets.h"
+#include "transport.h"
+#include "checksum.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
+#include <linux/filter.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
+
+// Helper function to get a monotonic timestamp in microseconds; unlike
+// gettimeofday it never jumps when the wall clock is adjusted
+long long get_timestamp_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 
 // Helper function to get current timestamp in milliseconds
-static long long get_timestamp_ms(void) {
-    struct timeval tp;
-    gettimeofday(&tp, NULL);
-    return tp.tv_sec * 1000LL + tp.tv_usec / 1000;
+long long get_timestamp_ms(void) {
+    return get_timestamp_us() / 1000;
+}
+
+// Peers remembered by send_packet, each with its own RTT estimate
+#define RTT_PEERS 16
+
+typedef struct {
+    int used;
+    int ifindex;
+    unsigned char halen;
+    unsigned char addr[8];
+    long long last_used_us;
+    RttEstimator rtt;
+} RttPeer;
+
+static RttPeer rtt_peers[RTT_PEERS];
+
+// PACKET_MMAP ring geometry (TPACKET_V2 fixed-size frame slots)
+#define RING_BLOCK_SIZE   (1 << 16)
+#define RING_FRAME_SIZE   2048
+#define RING_FRAME_NR     2048
+#define RING_SIZE         ((size_t)RING_FRAME_SIZE * RING_FRAME_NR)
+#define RING_TX_BATCH     32     // Queued TX frames that force a flush
+#define RING_MAX_FDS      1024
+
+// Shared-memory rings attached to a socket; the kernel and user space hand
+// frame slots back and forth through their tp_status words
+typedef struct {
+    uint8_t *map;
+    size_t map_size;
+    int rcv_timeout_ms;          // Mirrors SO_RCVTIMEO (0 = block forever)
+    uint8_t *rx_base;
+    unsigned rx_frame;           // Next slot to read
+    uint8_t *tx_base;
+    unsigned tx_frame;           // Next slot to fill
+    unsigned tx_pending;         // Slots filled since the last flush
+} PacketRing;
+
+static PacketRing *rings[RING_MAX_FDS];
+
+static PacketRing *ring_for(int socket_fd) {
+    if (socket_fd < 0 || socket_fd >= RING_MAX_FDS) return NULL;
+    return rings[socket_fd];
+}
+
+static struct tpacket2_hdr *ring_slot(uint8_t *base, unsigned frame) {
+    return (struct tpacket2_hdr *)(base + (size_t)frame * RING_FRAME_SIZE);
+}
+
+// True when the RX ring holds a frame we have not read yet
+static int ring_readable(const PacketRing *ring) {
+    const struct tpacket2_hdr *hdr = ring_slot(ring->rx_base, ring->rx_frame);
+    return (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) != 0;
+}
+
+void rtt_init(RttEstimator *rtt) {
+    memset(rtt, 0, sizeof(*rtt));
+}
+
+// Fold in one round-trip measurement. Callers follow Karn's rule and only
+// sample frames that were transmitted exactly once.
+void rtt_sample(RttEstimator *rtt, long long sample_us) {
+    if (sample_us <= 0) sample_us = 1;
+    
+    if (rtt->srtt_us == 0) {
+        rtt->srtt_us = sample_us;
+        rtt->rttvar_us = sample_us / 2;
+    } else {
+        long long err = rtt->srtt_us - sample_us;
+        if (err < 0) err = -err;
+        rtt->rttvar_us = (3 * rtt->rttvar_us + err) / 4;
+        rtt->srtt_us = (7 * rtt->srtt_us + sample_us) / 8;
+    }
+    
+    rtt->backoff = 0;  // A fresh sample ends any backoff
+}
+
+// A retransmission timer expired: double the timeout until the next sample
+void rtt_backoff(RttEstimator *rtt) {
+    if (rtt_timeout_us(rtt) < RTO_MAX_US) rtt->backoff++;
+}
+
+// RTO = SRTT + max(G, 4 * RTTVAR), doubled for every backoff
+long long rtt_timeout_us(const RttEstimator *rtt) {
+    long long rto = RTO_INITIAL_US;
+    if (rtt->srtt_us > 0) {
+        long long var = 4 * rtt->rttvar_us;
+        rto = rtt->srtt_us + (var > RTO_GRANULARITY_US ? var : RTO_GRANULARITY_US);
+    }
+    if (rto < RTO_MIN_US) rto = RTO_MIN_US;
+    
+    for (int i = 0; i < rtt->backoff && rto < RTO_MAX_US; i++) {
+        rto *= 2;
+    }
+    return rto < RTO_MAX_US ? rto : RTO_MAX_US;
+}
+
+// Estimator for the peer behind addr, allocated on first use
+static RttEstimator *rtt_for_peer(const struct sockaddr_ll *addr) {
+    RttPeer *victim = &rtt_peers[0];
+    long long now = get_timestamp_us();
+    
+    for (int i = 0; i < RTT_PEERS; i++) {
+        RttPeer *peer = &rtt_peers[i];
+        if (peer->used && peer->ifindex == addr->sll_ifindex && peer->halen == addr->sll_halen &&
+            memcmp(peer->addr, addr->sll_addr, addr->sll_halen) == 0) {
+            peer->last_used_us = now;
+            return &peer->rtt;
+        }
+        if (!peer->used || (victim->used && peer->last_used_us < victim->last_used_us)) {
+            victim = peer;
+        }
+    }
+    
+    // Reuse a free or least recently used slot
+    victim->used = 1;
+    victim->ifindex = addr->sll_ifindex;
+    victim->halen = addr->sll_halen > 8 ? 8 : addr->sll_halen;
+    memcpy(victim->addr, addr->sll_addr, victim->halen);
+    victim->last_used_us = now;
+    rtt_init(&victim->rtt);
+    return &victim->rtt;
 }
 
 // Calculate CRC (XOR) over header and data fields
 uint8_t calculate_crc(const Packet *pkt) {
-    uint8_t crc = 0;
-    // XOR over size, sequence, type
-    crc ^= pkt->size;
-    crc ^= pkt->seq;
-    crc ^= pkt->type;
-    
-    // XOR over data bytes
-    for (int i = 0; i < pkt->size; i++) {
-        crc ^= pkt->data[i];
+    return calculate_crc_data(pkt, pkt->data);
+}
+
+// Same checksum, with the payload taken from data instead of pkt->data
+uint8_t calculate_crc_data(const Packet *pkt, const uint8_t *data) {
+    // XOR over size, sequence, type, then the data bytes
+    return pkt->size ^ pkt->seq ^ pkt->type ^ xor_bytes(data, pkt->size);
+}
+
+// Header of an extended frame. The checksum is the same XOR as the spec's,
+// with both length bytes folded in, or with EXT_TYPE_CRC8 in `type` a CRC-8
+// over the header fields and the payload.
+void encode_ext_header(uint8_t *header, uint8_t seq, uint8_t type,
+                       const uint8_t *data, uint16_t size) {
+    header[0] = EXT_MARKER;
+    header[1] = seq & 0x1F;
+    header[2] = type & (0x0F | EXT_TYPE_CRC8);
+    header[3] = size >> 8;
+    header[4] = size & 0xFF;
+
+    if (type & EXT_TYPE_CRC8) {
+        header[5] = crc8_update(crc8_update(0, header + 1, 4), data, size);
+    } else {
+        header[5] = header[1] ^ header[2] ^ header[3] ^ header[4] ^ xor_bytes(data, size);
+    }
+}
+
+// Parse and verify a received frame of either format; returns 1 if valid
+int decode_frame(const void *buf, size_t len, Frame *frame) {
+    const uint8_t *bytes = buf;
+    if (len < 1) return 0;
+
+    if (bytes[0] == START_MARKER) {
+        if (!packet_length_ok(buf, len)) return 0;
+
+        Packet pkt;
+        unpack_packet((const PacketRaw *)buf, &pkt);
+        if (!validate_packet(&pkt)) return 0;
+
+        frame->seq = pkt.seq;
+        frame->type = pkt.type;
+        frame->size = pkt.size;
+        memcpy(frame->data, pkt.data, pkt.size);
+        return 1;
     }
-    return crc;
+
+    if (bytes[0] != EXT_MARKER || len < EXT_HEADER_SIZE) return 0;
+
+    uint16_t size = ((uint16_t)bytes[3] << 8) | bytes[4];
+    if (size > EXT_MAX_DATA_SIZE || len < EXT_HEADER_SIZE + (size_t)size) return 0;
+
+    uint8_t header[EXT_HEADER_SIZE];
+    encode_ext_header(header, bytes[1], bytes[2], bytes + EXT_HEADER_SIZE, size);
+    if (memcmp(header, bytes, EXT_HEADER_SIZE) != 0) return 0;
+
+    frame->seq = bytes[1];
+    frame->type = bytes[2] & 0x0F;
+    frame->size = size;
+    memcpy(frame->data, bytes + EXT_HEADER_SIZE, size);
+    return 1;
 }
 
 // Validate packet structure and checksum
@@ -63,6 +247,10 @@ int set_socket_timeout(int socket_fd, int timeout_ms) {
         return -1;
     }
     
+    // Ring reads never enter recvfrom, so they keep their own copy
+    PacketRing *ring = ring_for(socket_fd);
+    if (ring) ring->rcv_timeout_ms = timeout_ms;
+    
     return 0;
 }
 
@@ -84,12 +272,161 @@ int get_interface_info(int socket_fd, const char *iface, struct sockaddr_ll *add
     addr->sll_protocol = htons(ETH_P_ALL);
     addr->sll_ifindex = ifr.ifr_ifindex;
     
+    // Frames go out with the EtherType the socket is bound to, and to the
+    // broadcast address until the peer's own address is learned
+    struct sockaddr_ll bound;
+    socklen_t bound_len = sizeof(bound);
+    if (getsockname(socket_fd, (struct sockaddr *)&bound, &bound_len) == 0 &&
+        bound.sll_protocol != 0) {
+        addr->sll_protocol = bound.sll_protocol;
+    }
+    addr->sll_halen = ETH_ALEN;
+    memset(addr->sll_addr, 0xFF, ETH_ALEN);
+    
+    return 0;
+}
+
+// MTU of the interface, which bounds extended payloads
+int get_interface_mtu(int socket_fd, const char *iface) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, iface, IFNAMSIZ - 1);
+    
+    if (ioctl(socket_fd, SIOCGIFMTU, &ifr) < 0) {
+        perror("ioctl SIOCGIFMTU failed");
+        return -1;
+    }
+    return ifr.ifr_mtu;
+}
+
+// Configure one ring direction
+static int setup_ring(int sock_fd, int option) {
+    struct tpacket_req req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = RING_BLOCK_SIZE;
+    req.tp_block_nr = RING_SIZE / RING_BLOCK_SIZE;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = RING_FRAME_NR;
+    
+    if (setsockopt(sock_fd, SOL_PACKET, option, &req, sizeof(req)) < 0) {
+        perror(option == PACKET_TX_RING ? "setsockopt PACKET_TX_RING failed"
+                                        : "setsockopt PACKET_RX_RING failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Attach PACKET_MMAP rings to a bound socket. TPACKET_V2 hands over every
+// frame as soon as it lands; V3 batches them into blocks that are only
+// retired on a timer (>= 1 ms), which stalls a window-limited protocol.
+static int attach_rings(int sock_fd, unsigned flags) {
+    if (sock_fd >= RING_MAX_FDS) {
+        fprintf(stderr, "socket descriptor too large for ring table\n");
+        return -1;
+    }
+    
+    int version = TPACKET_V2;
+    if (setsockopt(sock_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("setsockopt PACKET_VERSION failed");
+        return -1;
+    }
+    
+    // Drop malformed TX frames instead of stalling the ring
+    int loss = 1;
+    setsockopt(sock_fd, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss));
+    
+    int rx = (flags & SOCKET_RX_RING) != 0;
+    int tx = (flags & SOCKET_TX_RING) != 0;
+    if (rx && setup_ring(sock_fd, PACKET_RX_RING) < 0) return -1;
+    if (tx && setup_ring(sock_fd, PACKET_TX_RING) < 0) return -1;
+    
+    PacketRing *ring = calloc(1, sizeof(PacketRing));
+    if (!ring) return -1;
+    
+    // RX and TX rings share one mapping, RX first
+    ring->map_size = RING_SIZE * (rx + tx);
+    ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, sock_fd, 0);
+    if (ring->map == MAP_FAILED) {
+        perror("mmap packet ring failed");
+        free(ring);
+        return -1;
+    }
+    
+    if (rx) ring->rx_base = ring->map;
+    if (tx) ring->tx_base = ring->map + (rx ? RING_SIZE : 0);
+    
+    rings[sock_fd] = ring;
+    return 0;
+}
+
+// Kernel-side filter: only frames that look like ours wake the process.
+// Accepts frames starting with START_MARKER (or EXT_MARKER) that are long
+// enough for the header plus the payload announced in their size field.
+static int attach_protocol_filter(int sock_fd) {
+    struct sock_filter code[] = {
+        // Frames we sent ourselves on another socket are not for us
+        BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   PACKET_OUTGOING, 13, 0),
+        // Start marker
+        BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   START_MARKER, 0, 5),
+        // X = header + size field (upper 7 bits of byte 1)
+        BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 1),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K,   1),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_K,   PACKET_HEADER_SIZE),
+        BPF_STMT(BPF_MISC | BPF_TAX,          0),
+        BPF_STMT(BPF_JMP | BPF_JA,            4),
+        // Extended frame: X = header + 16-bit length at bytes 3-4
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   EXT_MARKER, 0, 5),
+        BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 3),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_K,   EXT_HEADER_SIZE),
+        BPF_STMT(BPF_MISC | BPF_TAX,          0),
+        // Frame length must cover it
+        BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X,   0, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K,             0),        // Drop
+        BPF_STMT(BPF_RET | BPF_K,             0x40000),  // Accept whole frame
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code
+    };
+    
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        perror("setsockopt SO_ATTACH_FILTER failed");
+        return -1;
+    }
+    return 0;
+}
+
+// The spec's frames start where the destination MAC would be, so every
+// frame on the wire has to be seen
+static int enable_promiscuous(int sock_fd, int ifindex) {
+    struct packet_mreq mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.mr_ifindex = ifindex;
+    mr.mr_type = PACKET_MR_PROMISC;
+    
+    if (setsockopt(sock_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0) {
+        perror("setsockopt PACKET_ADD_MEMBERSHIP failed");
+        return -1;
+    }
     return 0;
 }
 
 // Create raw socket
 int create_raw_socket(const char *iface) {
-    int sock_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    return create_raw_socket_ex(iface, 0);
+}
+
+// Create raw socket with optional features (SOCKET_* flags)
+int create_raw_socket_ex(const char *iface, unsigned flags) {
+    // With our own EtherType the kernel adds and strips the Ethernet header
+    int ethertype = flags & SOCKET_ETHERTYPE;
+    
+    // Protocol 0 receives nothing until bind, so no frame can slip in
+    // ahead of the filter
+    int sock_fd = socket(AF_PACKET, ethertype ? SOCK_DGRAM : SOCK_RAW, 0);
     if (sock_fd < 0) {
         perror("socket creation failed");
         return -1;
@@ -102,21 +439,36 @@ int create_raw_socket(const char *iface) {
         return -1;
     }
     
-    // Bind to interface
+    if (attach_protocol_filter(sock_fd) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    
+    // Bind to interface (sll_protocol starts delivery)
+    addr.sll_protocol = htons(ethertype ? ETH_P_TREASURE : ETH_P_ALL);
     if (bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         perror("bind failed");
         close(sock_fd);
         return -1;
     }
     
-    // Enable promiscuous mode
-    struct packet_mreq mr;
-    memset(&mr, 0, sizeof(mr));
-    mr.mr_ifindex = addr.sll_ifindex;
-    mr.mr_type = PACKET_MR_PROMISC;
+    if (ethertype) {
+        // Frames are addressed to our MAC (or broadcast), so the NIC filter
+        // can stay on. The TX ring's flush carries no destination for the
+        // kernel to build each header from, so sends use sendmsg.
+        flags &= ~SOCKET_TX_RING;
+    } else if (enable_promiscuous(sock_fd, addr.sll_ifindex) < 0) {
+        close(sock_fd);
+        return -1;
+    }
     
-    if (setsockopt(sock_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0) {
-        perror("setsockopt PACKET_ADD_MEMBERSHIP failed");
+    if ((flags & (SOCKET_RX_RING | SOCKET_TX_RING)) && attach_rings(sock_fd, flags) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    
+    // Ring slots always carry a timestamp; recvmsg only with SO_TIMESTAMPNS
+    if ((flags & SOCKET_TIMESTAMPS) && trace_enable_timestamps(sock_fd) < 0) {
         close(sock_fd);
         return -1;
     }
@@ -124,44 +476,357 @@ int create_raw_socket(const char *iface) {
     return sock_fd;
 }
 
-// Send packet with retransmission and exponential backoff
+static int raw_flush(int socket_fd);
+
+// Close a socket created by create_raw_socket, releasing its rings
+static void raw_close(int socket_fd) {
+    PacketRing *ring = ring_for(socket_fd);
+    if (ring) {
+        raw_flush(socket_fd);
+        munmap(ring->map, ring->map_size);
+        free(ring);
+        rings[socket_fd] = NULL;
+    }
+    close(socket_fd);
+}
+
+// Hand every queued TX ring frame to the kernel in one syscall
+static int raw_flush(int socket_fd) {
+    PacketRing *ring = ring_for(socket_fd);
+    if (!ring || ring->tx_pending == 0) return 0;
+    
+    ring->tx_pending = 0;
+    if (send(socket_fd, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN) {
+        perror("TX ring flush failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Send one frame, through the TX ring when the socket has one
+ssize_t socket_send_raw(int socket_fd, const void *buf, size_t len, const struct sockaddr_ll *addr) {
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    return socket_send_iov(socket_fd, &iov, 1, addr);
+}
+
+// Send one frame gathered from several buffers. The kernel (or the copy
+// into the TX ring slot) reads each piece in place, so the caller never
+// has to assemble the frame.
+static ssize_t raw_send_iov(int socket_fd, const struct iovec *iov, int iovcnt,
+                            const struct sockaddr_ll *addr) {
+    PacketRing *ring = ring_for(socket_fd);
+    long long start_ns = trace_on() ? trace_now_ns() : 0;
+    if (!ring || !ring->tx_base) {
+        struct msghdr msg = {
+            .msg_name = (void *)addr,
+            .msg_namelen = sizeof(struct sockaddr_ll),
+            .msg_iov = (struct iovec *)iov,
+            .msg_iovlen = iovcnt
+        };
+        ssize_t sent = sendmsg(socket_fd, &msg, 0);
+        if (start_ns) trace_frame(TRACE_SEND, iov[0].iov_base, iov[0].iov_len, start_ns, trace_now_ns());
+        return sent;
+    }
+    
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    
+    size_t data_off = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+    if (len > RING_FRAME_SIZE - data_off) return -1;
+    
+    struct tpacket2_hdr *hdr = ring_slot(ring->tx_base, ring->tx_frame);
+    
+    // The slot is still owned by the kernel: push what we have and wait for it
+    while (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+           (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        ring->tx_pending = 1;
+        raw_flush(socket_fd);
+        struct pollfd pfd = { .fd = socket_fd, .events = POLLOUT };
+        poll(&pfd, 1, 1);
+    }
+    
+    uint8_t *dst = (uint8_t *)hdr + data_off;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    hdr->tp_len = len;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    
+    ring->tx_frame = (ring->tx_frame + 1) % RING_FRAME_NR;
+    if (++ring->tx_pending >= RING_TX_BATCH) {
+        raw_flush(socket_fd);
+    }
+    if (start_ns) trace_frame(TRACE_SEND, iov[0].iov_base, iov[0].iov_len, start_ns, trace_now_ns());
+    return len;
+}
+
+// Take the next frame out of the RX ring; returns 0 when the ring is empty
+static ssize_t ring_recv(PacketRing *ring, void *buf, size_t len, struct sockaddr_ll *addr) {
+    struct tpacket2_hdr *hdr = ring_slot(ring->rx_base, ring->rx_frame);
+    if (!(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+        return 0;
+    }
+    
+    size_t copied = hdr->tp_snaplen < len ? hdr->tp_snaplen : len;
+    memcpy(buf, (uint8_t *)hdr + hdr->tp_mac, copied);
+    if (addr) {
+        memcpy(addr, (uint8_t *)hdr + TPACKET_ALIGN(sizeof(struct tpacket2_hdr)),
+               sizeof(struct sockaddr_ll));
+    }
+    if (trace_on()) {
+        trace_frame(TRACE_RECV, buf, copied, trace_realtime_to_ns(hdr->tp_sec, hdr->tp_nsec),
+                    trace_now_ns());
+    }
+    
+    // Give the slot back to the kernel
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    ring->rx_frame = (ring->rx_frame + 1) % RING_FRAME_NR;
+    return copied;
+}
+
+// Send several frames with one sendmmsg (the TX ring batches by itself);
+// returns how many were sent, or -1 if none were
+static int raw_send_batch(int socket_fd, struct mmsghdr *msgs, unsigned count) {
+    PacketRing *ring = ring_for(socket_fd);
+    if (ring && ring->tx_base) {
+        for (unsigned i = 0; i < count; i++) {
+            raw_send_iov(socket_fd, msgs[i].msg_hdr.msg_iov, msgs[i].msg_hdr.msg_iovlen,
+                         msgs[i].msg_hdr.msg_name);
+        }
+        return count;
+    }
+    
+    unsigned sent = 0;
+    while (sent < count) {
+        long long start_ns = trace_on() ? trace_now_ns() : 0;
+        int n = sendmmsg(socket_fd, msgs + sent, count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("sendmmsg");
+            return sent > 0 ? (int)sent : -1;
+        }
+        if (start_ns) {
+            long long end_ns = trace_now_ns();
+            for (int i = 0; i < n; i++) {
+                const struct iovec *iov = msgs[sent + i].msg_hdr.msg_iov;
+                trace_frame(TRACE_SEND, iov[0].iov_base, iov[0].iov_len, start_ns, end_ns);
+            }
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+// Take up to max frames that are already waiting, without blocking.
+// Returns how many were stored (0 if none), or -1 on error.
+static int raw_recv_batch(int socket_fd, void *bufs, size_t buf_size, size_t *lens,
+                          struct sockaddr_ll *addrs, unsigned max) {
+    PacketRing *ring = ring_for(socket_fd);
+    if (ring && ring->rx_base) {
+        unsigned count = 0;
+        while (count < max) {
+            ssize_t received = ring_recv(ring, (uint8_t *)bufs + count * buf_size, buf_size,
+                                         &addrs[count]);
+            if (received <= 0) break;
+            lens[count++] = received;
+        }
+        return count;
+    }
+    
+    raw_flush(socket_fd);
+    
+    struct mmsghdr msgs[max];
+    struct iovec iov[max];
+    int tracing = trace_on();
+    uint8_t control[tracing ? max : 1][TRACE_CMSG_SIZE];
+    for (unsigned i = 0; i < max; i++) {
+        iov[i].iov_base = (uint8_t *)bufs + i * buf_size;
+        iov[i].iov_len = buf_size;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+        if (tracing) {
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = TRACE_CMSG_SIZE;
+        }
+    }
+    
+    int n = recvmmsg(socket_fd, msgs, max, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        perror("recvmmsg");
+        return -1;
+    }
+    long long now_ns = tracing ? trace_now_ns() : 0;
+    for (int i = 0; i < n; i++) {
+        lens[i] = msgs[i].msg_len;
+        if (tracing) {
+            long long kernel_ns = trace_cmsg_ns(&msgs[i].msg_hdr);
+            trace_frame(TRACE_RECV, iov[i].iov_base, lens[i], kernel_ns ? kernel_ns : now_ns, now_ns);
+        }
+    }
+    return n;
+}
+
+// Wait until a frame can be read (flushing queued TX frames first);
+// returns 1 when readable, 0 on timeout and -1 on error
+static int raw_wait(int socket_fd, int timeout_ms) {
+    PacketRing *ring = ring_for(socket_fd);
+    if (ring) {
+        raw_flush(socket_fd);
+        if (ring->rx_base && ring_readable(ring)) return 1;
+    }
+    
+    struct pollfd pfd = { .fd = socket_fd, .events = POLLIN };
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0) {
+        if (errno == EINTR) return 0;
+        perror("poll failed");
+        return -1;
+    }
+    return ready > 0;
+}
+
+// Receive one frame, from the RX ring when the socket has one. Blocks like
+// recvfrom (honouring set_socket_timeout) unless flags has MSG_DONTWAIT.
+static ssize_t raw_recv(int socket_fd, void *buf, size_t len, struct sockaddr_ll *addr,
+                        int flags) {
+    PacketRing *ring = ring_for(socket_fd);
+    if (!ring || !ring->rx_base) {
+        raw_flush(socket_fd);
+        if (!trace_on()) {
+            socklen_t addr_len = sizeof(struct sockaddr_ll);
+            return recvfrom(socket_fd, buf, len, flags, (struct sockaddr *)addr, addr ? &addr_len : NULL);
+        }
+        
+        uint8_t control[TRACE_CMSG_SIZE];
+        struct iovec iov = { .iov_base = buf, .iov_len = len };
+        struct msghdr msg = {
+            .msg_name = addr,
+            .msg_namelen = addr ? sizeof(struct sockaddr_ll) : 0,
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control)
+        };
+        ssize_t received = recvmsg(socket_fd, &msg, flags);
+        if (received > 0) {
+            long long now_ns = trace_now_ns();
+            long long kernel_ns = trace_cmsg_ns(&msg);
+            trace_frame(TRACE_RECV, buf, received, kernel_ns ? kernel_ns : now_ns, now_ns);
+        }
+        return received;
+    }
+    
+    long long deadline = get_timestamp_ms() + ring->rcv_timeout_ms;
+    while (1) {
+        ssize_t received = ring_recv(ring, buf, len, addr);
+        if (received > 0) return received;
+        
+        if (flags & MSG_DONTWAIT) {
+            errno = EAGAIN;
+            return -1;
+        }
+        
+        int timeout = -1;
+        if (ring->rcv_timeout_ms > 0) {
+            long long remaining = deadline - get_timestamp_ms();
+            if (remaining <= 0) {
+                errno = EAGAIN;
+                return -1;
+            }
+            timeout = (int)remaining;
+        }
+        if (raw_wait(socket_fd, timeout) < 0) return -1;
+    }
+}
+
+const TransportOps raw_transport = {
+    .name = "raw",
+    .send_iov = raw_send_iov,
+    .send_batch = raw_send_batch,
+    .recv = raw_recv,
+    .recv_batch = raw_recv_batch,
+    .wait = raw_wait,
+    .flush = raw_flush,
+    .close = raw_close
+};
+
+// The socket_* calls work on any descriptor: each one goes to the
+// transport registered for it, the raw socket unless told otherwise
+void close_raw_socket(int socket_fd) {
+    const TransportOps *ops = transport_for(socket_fd);
+    transport_unregister(socket_fd);
+    ops->close(socket_fd);
+}
+
+int socket_flush(int socket_fd) {
+    return transport_for(socket_fd)->flush(socket_fd);
+}
+
+ssize_t socket_send_iov(int socket_fd, const struct iovec *iov, int iovcnt,
+                        const struct sockaddr_ll *addr) {
+    return transport_for(socket_fd)->send_iov(socket_fd, iov, iovcnt, addr);
+}
+
+int socket_send_batch(int socket_fd, struct mmsghdr *msgs, unsigned count) {
+    return transport_for(socket_fd)->send_batch(socket_fd, msgs, count);
+}
+
+int socket_recv_batch(int socket_fd, void *bufs, size_t buf_size, size_t *lens,
+                      struct sockaddr_ll *addrs, unsigned max) {
+    return transport_for(socket_fd)->recv_batch(socket_fd, bufs, buf_size, lens, addrs, max);
+}
+
+int socket_wait(int socket_fd, int timeout_ms) {
+    return transport_for(socket_fd)->wait(socket_fd, timeout_ms);
+}
+
+ssize_t socket_recv_raw(int socket_fd, void *buf, size_t len, struct sockaddr_ll *addr, int flags) {
+    return transport_for(socket_fd)->recv(socket_fd, buf, len, addr, flags);
+}
+
+// Send packet with retransmission; the timeout adapts to the peer's
+// measured round-trip time and backs off exponentially on repeated loss
 int send_packet(int socket_fd, const Packet *pkt, struct sockaddr_ll *addr) {
     if (!pkt || !addr) return -1;
     
     // Pack the logical packet into wire format
     PacketRaw raw_pkt;
-    pack_packet(pkt, &raw_pkt);
+    size_t len = pack_packet(pkt, &raw_pkt);
     
     // Calculate checksum on the logical packet before sending
     ((Packet *)pkt)->checksum = calculate_crc(pkt);
     raw_pkt.checksum = pkt->checksum;
     
-    int timeout_ms = 1000;  // Start with 1 second timeout
+    RttEstimator *rtt = rtt_for_peer(addr);
     const int max_retries = 5;
     int retries = 0;
+    long long first_sent = get_timestamp_us();
     
-    while (retries < max_retries) {
-        // Set timeout for this attempt
-        if (set_socket_timeout(socket_fd, timeout_ms) < 0) {
-            return -1;
-        }
-        
+    // As many retries as it takes to cover PEER_GIVE_UP_US when the RTO is short
+    while (retries < max_retries || get_timestamp_us() - first_sent < PEER_GIVE_UP_US) {
         // Send the packed packet
-        ssize_t sent = sendto(socket_fd, &raw_pkt, sizeof(PacketRaw), 0,
-                            (struct sockaddr *)addr, sizeof(struct sockaddr_ll));
+        long long sent_at = get_timestamp_us();
+        ssize_t sent = socket_send_raw(socket_fd, &raw_pkt, len, addr);
         
-        if (sent == sizeof(PacketRaw)) {
-            // Wait for ACK
-            PacketRaw ack_raw;
-            ssize_t received = recvfrom(socket_fd, &ack_raw, sizeof(PacketRaw), 0, NULL, NULL);
+        if (sent == (ssize_t)len) {
+            // Wait for ACK on our own clock
+            long long deadline = sent_at + rtt_timeout_us(rtt);
+            long long remaining;
             
-            if (received == sizeof(PacketRaw)) {
+            while ((remaining = deadline - get_timestamp_us()) > 0) {
                 Packet ack;
-                unpack_packet(&ack_raw, &ack);
+                if (receive_frame(socket_fd, &ack, NULL, (int)((remaining + 999) / 1000)) < 0) break;
                 
-                if (ack.start_marker == START_MARKER &&
-                    ack.type == PKT_ACK &&
-                    validate_packet(&ack)) {
+                if (ack.type == PKT_ACK) {
+                    // Karn's rule: a retransmitted frame gives an ambiguous sample
+                    if (retries == 0) rtt_sample(rtt, get_timestamp_us() - sent_at);
                     return 0;  // Success
                 }
             }
@@ -169,7 +834,7 @@ int send_packet(int socket_fd, const Packet *pkt, struct sockaddr_ll *addr) {
         
         // If we get here, either send failed or no valid ACK received
         retries++;
-        timeout_ms *= 2;  // Exponential backoff
+        rtt_backoff(rtt);  // Exponential backoff
     }
     
     return -1;  // All retries failed
@@ -179,16 +844,14 @@ int send_packet(int socket_fd, const Packet *pkt, struct sockaddr_ll *addr) {
 ssize_t receive_packet(int socket_fd, Packet *pkt, struct sockaddr_ll *addr) {
     if (!pkt || !addr) return -1;
     
-    socklen_t addr_len = sizeof(struct sockaddr_ll);
     long long start_time = get_timestamp_ms();
     const int timeout_ms = 300;  // 300ms timeout
     
     while (get_timestamp_ms() - start_time < timeout_ms) {
         PacketRaw raw_pkt;
-        ssize_t received = recvfrom(socket_fd, &raw_pkt, sizeof(PacketRaw), 0,
-                                  (struct sockaddr *)addr, &addr_len);
+        ssize_t received = socket_recv_raw(socket_fd, &raw_pkt, sizeof(PacketRaw), addr, 0);
         
-        if (received == sizeof(PacketRaw)) {
+        if (received > 0 && packet_length_ok(&raw_pkt, received)) {
             // Unpack the received packet
             unpack_packet(&raw_pkt, pkt);
             
@@ -203,10 +866,9 @@ ssize_t receive_packet(int socket_fd, Packet *pkt, struct sockaddr_ll *addr) {
                 ack.checksum = calculate_crc(&ack);
                 
                 PacketRaw ack_raw;
-                pack_packet(&ack, &ack_raw);
+                size_t ack_len = pack_packet(&ack, &ack_raw);
                 
-                if (sendto(socket_fd, &ack_raw, sizeof(PacketRaw), 0,
-                          (struct sockaddr *)addr, addr_len) == sizeof(PacketRaw)) {
+                if (socket_send_raw(socket_fd, &ack_raw, ack_len, addr) == (ssize_t)ack_len) {
                     return received;
                 }
             }
@@ -216,21 +878,63 @@ ssize_t receive_packet(int socket_fd, Packet *pkt, struct sockaddr_ll *addr) {
     return -1;  // Timeout or invalid packet
 }
 
+// Wait for a valid frame without acknowledging it (used by the ARQ layer)
+ssize_t receive_frame(int socket_fd, Packet *pkt, struct sockaddr_ll *addr, int timeout_ms) {
+    if (!pkt) return -1;
+    
+    long long deadline = get_timestamp_ms() + timeout_ms;
+    
+    while (1) {
+        long long remaining = deadline - get_timestamp_ms();
+        if (remaining < 0) return -1;  // Timeout
+        
+        // Keep our own clock: stray frames must not restart the wait
+        int ready = socket_wait(socket_fd, (int)remaining);
+        if (ready < 0) return -1;
+        if (ready == 0) continue;  // Re-check the deadline
+        
+        PacketRaw raw_pkt;
+        struct sockaddr_ll from;
+        ssize_t received = socket_recv_raw(socket_fd, &raw_pkt, sizeof(PacketRaw), &from, MSG_DONTWAIT);
+        
+        if (received > 0 && packet_length_ok(&raw_pkt, received)) {
+            unpack_packet(&raw_pkt, pkt);
+            
+            if (validate_packet(pkt)) {
+                if (addr) *addr = from;
+                return received;
+            }
+        }
+    }
+}
+
+// Send a single frame without waiting for an acknowledgement
+int send_frame(int socket_fd, const Packet *pkt, struct sockaddr_ll *addr) {
+    Packet frame = *pkt;
+    frame.start_marker = START_MARKER;
+    frame.checksum = calculate_crc(&frame);
+    
+    PacketRaw raw_pkt;
+    size_t len = pack_packet(&frame, &raw_pkt);
+    
+    ssize_t sent = socket_send_raw(socket_fd, &raw_pkt, len, addr);
+    return (sent == (ssize_t)len) ? 0 : -1;
+}
+
 // Send ACK packet
 void send_ack(int socket_fd, struct sockaddr_ll *addr, uint8_t type) {
+    send_ack_seq(socket_fd, addr, type, 0);  // Sequence number should be set by caller if needed
+}
+
+// Send ACK packet carrying the sequence number being acknowledged
+void send_ack_seq(int socket_fd, struct sockaddr_ll *addr, uint8_t type, uint8_t seq) {
     Packet ack = {
         .start_marker = START_MARKER,
         .size = 0,
-        .seq = 0,  // Sequence number should be set by caller if needed
+        .seq = seq & 0x1F,
         .type = type
     };
-    ack.checksum = calculate_crc(&ack);
-    
-    PacketRaw ack_raw;
-    pack_packet(&ack, &ack_raw);
-    
-    sendto(socket_fd, &ack_raw, sizeof(PacketRaw), 0,
-           (struct sockaddr *)addr, sizeof(struct sockaddr_ll));
+    send_frame(socket_fd, &ack, addr);
 }
 
 // Send ACK packet with position
@@ -243,13 +947,7 @@ void send_ack_with_position(int socket_fd, struct sockaddr_ll *addr, uint8_t typ
     };
     ack.data[0] = x;
     ack.data[1] = y;
-    ack.checksum = calculate_crc(&ack);
-    
-    PacketRaw ack_raw;
-    pack_packet(&ack, &ack_raw);
-    
-    sendto(socket_fd, &ack_raw, sizeof(PacketRaw), 0,
-           (struct sockaddr *)addr, sizeof(struct sockaddr_ll));
+    send_frame(socket_fd, &ack, addr);
 }
 
 // Send error packet
@@ -261,11 +959,5 @@ void send_error(int socket_fd, struct sockaddr_ll *addr, uint8_t code) {
         .type = PKT_ERROR,
         .data = {code}
     };
-    err.checksum = calculate_crc(&err);
-    
-    PacketRaw err_raw;
-    pack_packet(&err, &err_raw);
-    
-    sendto(socket_fd, &err_raw, sizeof(PacketRaw), 0,
-           (struct sockaddr *)addr, sizeof(struct sockaddr_ll));
-}
\ No newline at end of file
+    send_frame(socket_fd, &err, addr);
+}
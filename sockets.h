@@ -8,14 +8,40 @@
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>  // Added for memcpy in inline functions
 
 #define MAX_DATA_SIZE 127
 #define START_MARKER   0x7E
 
+// The game both ends play: positions travel as bytes, paths pack x << 4 | y
+#define GRID_SIZE      8
+#define MAX_TREASURES  8
+
+// Extended data frames, only sent after both ends agreed via PKT_EXTENSION:
+// marker, seq, type, 16-bit length (big endian), checksum, payload
+#define EXT_MARKER        0x7D
+#define EXT_HEADER_SIZE   6
+#define EXT_MAX_DATA_SIZE 1494  // Fills a 1500-byte MTU
+#define MAX_FRAME_SIZE    (EXT_HEADER_SIZE + EXT_MAX_DATA_SIZE)
+// Set in an extended frame's type byte: the checksum is a CRC-8 over the
+// header and payload instead of the XOR
+#define EXT_TYPE_CRC8     0x80
+
+// Options for create_raw_socket_ex
+#define SOCKET_RX_RING 0x01  // PACKET_MMAP TPACKET_V2 receive ring
+#define SOCKET_TX_RING 0x02  // PACKET_MMAP transmit ring, flushed in batches
+#define SOCKET_ETHERTYPE 0x04  // Frames behind an Ethernet header with ETH_P_TREASURE
+#define SOCKET_TIMESTAMPS 0x08 // Kernel receive timestamps, for the tracer
+
+// IEEE 802 local experimental EtherType: with SOCKET_ETHERTYPE the kernel
+// hands us only these frames, and no promiscuous mode is needed
+#define ETH_P_TREASURE 0x88B5
+
 // Packet types
 typedef enum {
     PKT_ACK        = 0,
@@ -32,9 +58,46 @@ typedef enum {
     PKT_MOVE_UP    = 11,
     PKT_MOVE_DOWN  = 12,
     PKT_MOVE_LEFT  = 13,
+    PKT_EXTENSION  = 14, // Capability exchange (type unused by the spec)
     PKT_ERROR      = 15
 } PacketType;
 
+// PKT_EXTENSION opcodes, in data[0]. In the hello and its ACK data[1..2]
+// carry the payload size, the optional data[3] the checksum and the
+// optional data[4] the ExtFlags.
+typedef enum {
+    EXT_HELLO      = 0,  // Client: largest extended payload I accept
+    EXT_HELLO_ACK  = 1,  // Server: payload size both ends will use
+    EXT_RESUME     = 2,  // Client, after a file name: offset (data[1..4]) and
+                         // XXH64 of the bytes before it (data[5..12]) I hold
+    EXT_RESUME_ACK = 3,  // Server, in the transfer window: data starts at data[1..4]
+    EXT_PATH       = 4,  // Client: PKT_MOVE_* types in data[1..], applied in order
+    EXT_PATH_ACK   = 5   // Server: moves applied (data[1], with PATH_FILE_FOLLOWS when
+                         // the last one found a treasure) and the position after each
+                         // (data[2..], x << 4 | y, or PATH_REFUSED)
+} ExtOpcode;
+
+// Optional features, asked for in EXT_HELLO and granted in the ACK
+typedef enum {
+    EXT_FLAG_RESUME = 0x01, // Transfers pause after the file name for EXT_RESUME
+    EXT_FLAG_HASH   = 0x02, // PKT_SIZE carries the file's XXH64 in data[6..13]; an
+                            // EXT_RESUME at the file size with that hash skips the data
+    EXT_FLAG_PATH   = 0x04  // Moves may travel several to a frame in EXT_PATH
+} ExtFlags;
+
+#define EXT_RESUME_SIZE     13
+#define EXT_RESUME_ACK_SIZE 5
+#define SIZE_HASH_SIZE      14  // PKT_SIZE with EXT_FLAG_HASH: size, x, y, XXH64
+#define EXT_PATH_MAX_MOVES  64
+#define PATH_REFUSED        0xFF  // EXT_PATH_ACK: the move would leave the grid
+#define PATH_FILE_FOLLOWS   0x80  // EXT_PATH_ACK: the treasure's PKT_SIZE comes next
+
+// Checksum of extended frames: asked for in EXT_HELLO, confirmed in the ACK
+typedef enum {
+    EXT_CHECK_XOR  = 0,
+    EXT_CHECK_CRC8 = 1
+} ExtCheck;
+
 // Error codes
 typedef enum {
     ERR_NO_PERMISSION = 0,
@@ -62,17 +125,51 @@ typedef struct {
 } Packet;
 #pragma pack(pop)
 
+#define PACKET_HEADER_SIZE offsetof(PacketRaw, data)
+#define MIN_FRAME_SIZE     ETH_ZLEN  // Ethernet minimum without the FCS
+
+// Bytes a frame with `size` payload bytes occupies on the wire: the header
+// and payload only, padded up to the Ethernet minimum
+static inline size_t packet_wire_size(uint8_t size) {
+    size_t len = PACKET_HEADER_SIZE + size;
+    return len < MIN_FRAME_SIZE ? MIN_FRAME_SIZE : len;
+}
+
+// A received frame must hold at least the payload its header announces
+static inline int packet_length_ok(const PacketRaw *raw, size_t len) {
+    return len >= PACKET_HEADER_SIZE && len >= PACKET_HEADER_SIZE + (raw->size_seq_type >> 1);
+}
+
 // Helper functions to pack/unpack the bit fields
-static inline void pack_packet(const Packet *logical, PacketRaw *raw) {
+static inline void pack_header(const Packet *logical, PacketRaw *raw) {
     raw->start_marker = logical->start_marker;
     // Pack size (7 bits), seq (5 bits), type (4 bits) into 16 bits
-    uint16_t packed = ((uint16_t)logical->size << 9) | 
-                     ((uint16_t)logical->seq << 4) | 
-                     ((uint16_t)logical->type);
+    uint16_t packed = ((uint16_t)(logical->size & 0x7F) << 9) | 
+                     ((uint16_t)(logical->seq & 0x1F) << 4) | 
+                     ((uint16_t)(logical->type & 0x0F));
     raw->size_seq_type = packed >> 8;
     raw->size_seq_type2 = packed & 0xFF;
     raw->checksum = logical->checksum;
-    memcpy(raw->data, logical->data, MAX_DATA_SIZE);
+}
+
+// Copies only the payload that is present and zeroes the padding;
+// returns the number of bytes to send
+static inline size_t pack_packet(const Packet *logical, PacketRaw *raw) {
+    uint8_t size = logical->size & 0x7F;
+    size_t len = packet_wire_size(size);
+    pack_header(logical, raw);
+    memcpy(raw->data, logical->data, size);
+    memset(raw->data + size, 0, len - PACKET_HEADER_SIZE - size);
+    return len;
+}
+
+// Fill in the sequence number of a frame encoded with seq 0. The XOR
+// checksum covered a zero seq, so it only needs the new value folded in.
+static inline void patch_seq(PacketRaw *raw, uint8_t seq) {
+    seq &= 0x1F;
+    raw->size_seq_type |= seq >> 4;
+    raw->size_seq_type2 |= (seq & 0x0F) << 4;
+    raw->checksum ^= seq;
 }
 
 static inline void unpack_packet(const PacketRaw *raw, Packet *logical) {
@@ -83,19 +180,66 @@ static inline void unpack_packet(const PacketRaw *raw, Packet *logical) {
     logical->seq = (packed >> 4) & 0x1F;   // Extract 5 bits
     logical->type = packed & 0x0F;         // Extract 4 bits
     logical->checksum = raw->checksum;
-    memcpy(logical->data, raw->data, MAX_DATA_SIZE);
+    memcpy(logical->data, raw->data, logical->size);
 }
 
+// A received data frame in either format, with room for extended payloads
+typedef struct {
+    uint8_t seq;
+    uint8_t type;
+    uint16_t size;
+    uint8_t data[EXT_MAX_DATA_SIZE];
+} Frame;
+
+// Retransmission timeout estimator (Jacobson/Karels), one per peer
+#define RTO_INITIAL_US 1000000LL   // Before the first sample: 1 s
+#define RTO_GRANULARITY_US 1000LL  // Timer resolution (poll works in ms)
+#define RTO_MIN_US     1000LL
+#define RTO_MAX_US     16000000LL
+#define PEER_GIVE_UP_US 30000000LL  // Silence that means the peer is gone, however short the RTO
+
+typedef struct {
+    long long srtt_us;     // Smoothed round-trip time (0 until the first sample)
+    long long rttvar_us;   // Round-trip time variation
+    int backoff;           // Timeouts since the last valid sample
+} RttEstimator;
+
+void      rtt_init(RttEstimator *rtt);
+void      rtt_sample(RttEstimator *rtt, long long sample_us);
+void      rtt_backoff(RttEstimator *rtt);
+long long rtt_timeout_us(const RttEstimator *rtt);
+
 // Core functions
 uint8_t calculate_crc(const Packet *pkt);
+uint8_t calculate_crc_data(const Packet *pkt, const uint8_t *data);
+void    encode_ext_header(uint8_t *header, uint8_t seq, uint8_t type,
+                          const uint8_t *data, uint16_t size);
+int     decode_frame(const void *buf, size_t len, Frame *frame);
 int     send_packet(int socket_fd, const Packet *pkt, struct sockaddr_ll *addr);
 ssize_t receive_packet(int socket_fd, Packet *pkt, struct sockaddr_ll *addr);
+int     send_frame(int socket_fd, const Packet *pkt, struct sockaddr_ll *addr);
+ssize_t receive_frame(int socket_fd, Packet *pkt, struct sockaddr_ll *addr, int timeout_ms);
 void    send_ack(int socket_fd, struct sockaddr_ll *addr, uint8_t type);
+void    send_ack_seq(int socket_fd, struct sockaddr_ll *addr, uint8_t type, uint8_t seq);
 void    send_ack_with_position(int socket_fd, struct sockaddr_ll *addr, uint8_t type, uint8_t x, uint8_t y);
 void    send_error(int socket_fd, struct sockaddr_ll *addr, uint8_t code);
 int     set_socket_timeout(int socket_fd, int timeout_ms);
 int     get_interface_info(int socket_fd, const char *iface, struct sockaddr_ll *addr);
+int     get_interface_mtu(int socket_fd, const char *iface);
 int     create_raw_socket(const char *iface);
+int     create_raw_socket_ex(const char *iface, unsigned flags);
+void    close_raw_socket(int socket_fd);
+ssize_t socket_send_raw(int socket_fd, const void *buf, size_t len, const struct sockaddr_ll *addr);
+ssize_t socket_send_iov(int socket_fd, const struct iovec *iov, int iovcnt,
+                        const struct sockaddr_ll *addr);
+ssize_t socket_recv_raw(int socket_fd, void *buf, size_t len, struct sockaddr_ll *addr, int flags);
+int     socket_send_batch(int socket_fd, struct mmsghdr *msgs, unsigned count);
+int     socket_recv_batch(int socket_fd, void *bufs, size_t buf_size, size_t *lens,
+                          struct sockaddr_ll *addrs, unsigned max);
+int     socket_wait(int socket_fd, int timeout_ms);
+int     socket_flush(int socket_fd);
 int     validate_packet(const Packet *pkt);
+long long get_timestamp_ms(void);
+long long get_timestamp_us(void);
 
 #endif // SOCKETS_H
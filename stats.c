@@ -0,0 +1,206 @@
+// stats.c
+#include "stats.h"
+#include "sockets.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+StatsTable *stats_create(int shared) {
+    StatsTable *table;
+
+    if (shared) {
+        int fd = shm_open(STATS_SHM_NAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("shm_open failed");
+            return NULL;
+        }
+        if (ftruncate(fd, sizeof(StatsTable)) < 0) {
+            perror("ftruncate failed");
+            close(fd);
+            shm_unlink(STATS_SHM_NAME);
+            return NULL;
+        }
+        table = mmap(NULL, sizeof(StatsTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (table == MAP_FAILED) {
+            perror("mmap failed");
+            shm_unlink(STATS_SHM_NAME);
+            return NULL;
+        }
+        memset(table, 0, sizeof(*table));
+    } else {
+        table = calloc(1, sizeof(StatsTable));
+        if (!table) {
+            perror("calloc failed");
+            return NULL;
+        }
+    }
+
+    table->max_peers = STATS_MAX_PEERS;
+    table->started_us = get_timestamp_us();
+    atomic_store(&table->other.since_us, table->started_us);
+    atomic_store(&table->other.in_use, 1);
+    atomic_store(&table->pid, getpid());
+    table->magic = STATS_MAGIC;  // Last: a viewer only trusts a stamped table
+    return table;
+}
+
+void stats_destroy(StatsTable *table, int shared) {
+    if (!table) return;
+    if (shared) {
+        munmap(table, sizeof(StatsTable));
+        shm_unlink(STATS_SHM_NAME);
+    } else {
+        free(table);
+    }
+}
+
+const StatsTable *stats_map(void) {
+    int fd = shm_open(STATS_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(StatsTable)) {
+        close(fd);
+        return NULL;
+    }
+    const StatsTable *table = mmap(NULL, sizeof(StatsTable), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) return NULL;
+
+    if (table->magic != STATS_MAGIC || table->max_peers != STATS_MAX_PEERS) {
+        munmap((void *)table, sizeof(StatsTable));
+        return NULL;
+    }
+    return table;
+}
+
+PeerStats *stats_attach(StatsTable *table, const uint8_t *mac) {
+    if (!table) return NULL;
+
+    for (int i = 0; i < STATS_MAX_PEERS; i++) {
+        PeerStats *peer = &table->peers[i];
+        uint32_t expected = 0;
+        if (!atomic_compare_exchange_strong(&peer->in_use, &expected, 1)) continue;
+
+        memset(&peer->c, 0, sizeof(peer->c));
+        memcpy(peer->mac, mac, ETH_ALEN);
+        atomic_store(&peer->since_us, get_timestamp_us());
+        return peer;
+    }
+    return &table->other;
+}
+
+void stats_detach(StatsTable *table, PeerStats *peer) {
+    if (!table || !peer || peer == &table->other) return;
+    atomic_store(&peer->in_use, 0);
+}
+
+void stats_rtt(PeerStats *peer, long long rtt_us) {
+    int bucket = 0;
+    while (bucket < STATS_RTT_BUCKETS - 1 && rtt_us >= (2LL << bucket)) {
+        bucket++;
+    }
+    stats_add(&peer->c.rtt_hist[bucket], 1);
+}
+
+// Upper edge of the bucket holding the given percentile (0 without samples)
+long long stats_rtt_percentile(const PeerCounters *c, int percent) {
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_RTT_BUCKETS; i++) {
+        total += stats_get(&c->rtt_hist[i]);
+    }
+    if (total == 0) return 0;
+
+    uint64_t rank = (total * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_RTT_BUCKETS; i++) {
+        seen += stats_get(&c->rtt_hist[i]);
+        if (seen >= rank) return 2LL << i;
+    }
+    return 2LL << (STATS_RTT_BUCKETS - 1);
+}
+
+static void dump_row(FILE *out, const PeerStats *peer, const char *name, long long now,
+                     StatsSnapshot *prev, int slot) {
+    const PeerCounters *c = &peer->c;
+    uint64_t sent = stats_get(&c->bytes_sent);
+    uint64_t received = stats_get(&c->bytes_received);
+    uint64_t samples = 0;
+    for (int i = 0; i < STATS_RTT_BUCKETS; i++) {
+        samples += stats_get(&c->rtt_hist[i]);
+    }
+
+    // Bytes per second since the previous dump, or since the row was claimed
+    long long since = atomic_load(&peer->since_us);
+    double tx_rate = 0, rx_rate = 0;
+    if (prev && prev->at_us > since && sent >= prev->bytes_sent[slot] &&
+        received >= prev->bytes_received[slot]) {
+        double seconds = (now - prev->at_us) / 1e6;
+        if (seconds > 0) {
+            tx_rate = (sent - prev->bytes_sent[slot]) / seconds;
+            rx_rate = (received - prev->bytes_received[slot]) / seconds;
+        }
+    } else if (now > since) {
+        tx_rate = sent / ((now - since) / 1e6);
+        rx_rate = received / ((now - since) / 1e6);
+    }
+    if (prev) {
+        prev->bytes_sent[slot] = sent;
+        prev->bytes_received[slot] = received;
+    }
+
+    fprintf(out, "peer=%s up_s=%.1f frames_sent=%lu frames_received=%lu "
+                 "bytes_sent=%lu bytes_received=%lu retransmits=%lu timeouts=%lu "
+                 "checksum_failures=%lu invalid_markers=%lu duplicates=%lu "
+                 "rtt_samples=%lu rtt_p50_us=%lld rtt_p99_us=%lld tx_Bps=%.0f rx_Bps=%.0f\n",
+            name, (now - since) / 1e6,
+            (unsigned long)stats_get(&c->frames_sent), (unsigned long)stats_get(&c->frames_received),
+            (unsigned long)sent, (unsigned long)received,
+            (unsigned long)stats_get(&c->retransmits), (unsigned long)stats_get(&c->timeouts),
+            (unsigned long)stats_get(&c->checksum_failures),
+            (unsigned long)stats_get(&c->invalid_markers),
+            (unsigned long)stats_get(&c->duplicates), (unsigned long)samples,
+            stats_rtt_percentile(c, 50), stats_rtt_percentile(c, 99), tx_rate, rx_rate);
+}
+
+void stats_dump(const StatsTable *table, FILE *out, StatsSnapshot *prev) {
+    long long now = get_timestamp_us();
+    fprintf(out, "# pid=%d uptime_s=%.1f\n", atomic_load(&table->pid),
+            (now - table->started_us) / 1e6);
+
+    for (int i = 0; i < STATS_MAX_PEERS; i++) {
+        const PeerStats *peer = &table->peers[i];
+        if (!atomic_load(&peer->in_use)) continue;
+
+        char name[18];
+        snprintf(name, sizeof(name), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 peer->mac[0], peer->mac[1], peer->mac[2],
+                 peer->mac[3], peer->mac[4], peer->mac[5]);
+        dump_row(out, peer, name, now, prev, i + 1);
+    }
+    dump_row(out, &table->other, "other", now, prev, 0);
+
+    if (prev) prev->at_us = now;
+    fflush(out);
+}
+
+int stats_write_file(const StatsTable *table, const char *path, StatsSnapshot *prev) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *out = fopen(tmp, "w");
+    if (!out) {
+        perror("fopen stats file failed");
+        return -1;
+    }
+    stats_dump(table, out, prev);
+    if (fclose(out) != 0 || rename(tmp, path) < 0) {
+        perror("write stats file failed");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
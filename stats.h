@@ -0,0 +1,78 @@
+// stats.h
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <net/ethernet.h>
+
+#define STATS_MAX_PEERS   64     // Peers with a row of their own; the rest share `other`
+#define STATS_RTT_BUCKETS 24     // Bucket i: RTTs in [2^i, 2^(i+1)) us, the last open-ended
+#define STATS_SHM_NAME    "/treasure-stats"
+#define STATS_MAGIC       0x54535431u  // "TST1": layout version of the shared table
+
+// Counters only ever grow, and every update is a relaxed atomic add, so the
+// receive thread, the workers and a reader in another process need no lock
+typedef struct {
+    _Atomic uint64_t frames_sent, frames_received;
+    _Atomic uint64_t bytes_sent, bytes_received;   // Whole frames, as handed to or taken from the socket
+    _Atomic uint64_t retransmits;
+    _Atomic uint64_t timeouts;
+    _Atomic uint64_t checksum_failures;
+    _Atomic uint64_t invalid_markers;   // Too short, or no frame marker
+    _Atomic uint64_t duplicates;        // ACKs that acknowledged nothing new
+    _Atomic uint64_t rtt_hist[STATS_RTT_BUCKETS];
+} PeerCounters;
+
+typedef struct {
+    _Atomic uint32_t in_use;
+    uint8_t mac[ETH_ALEN];
+    _Atomic long long since_us;         // When the row was claimed
+    PeerCounters c;
+} PeerStats;
+
+// One per process; lives in shared memory when published
+typedef struct {
+    uint32_t magic;
+    uint32_t max_peers;
+    long long started_us;
+    _Atomic int pid;
+    PeerStats other;                    // Unknown senders, and peers beyond the table
+    PeerStats peers[STATS_MAX_PEERS];
+} StatsTable;
+
+// Rates between two dumps are computed against the previous one
+typedef struct {
+    long long at_us;
+    uint64_t bytes_sent[STATS_MAX_PEERS + 1];
+    uint64_t bytes_received[STATS_MAX_PEERS + 1];
+} StatsSnapshot;
+
+static inline void stats_add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static inline uint64_t stats_get(const _Atomic uint64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// With `shared`, the table is a POSIX shared memory segment a viewer can map
+StatsTable *stats_create(int shared);
+void        stats_destroy(StatsTable *table, int shared);
+// Read-only mapping of a running process's table (NULL if none)
+const StatsTable *stats_map(void);
+
+// Claim a zeroed row for a peer, or share `other` when the table is full
+PeerStats *stats_attach(StatsTable *table, const uint8_t *mac);
+void       stats_detach(StatsTable *table, PeerStats *peer);
+
+void stats_rtt(PeerStats *peer, long long rtt_us);
+long long stats_rtt_percentile(const PeerCounters *c, int percent);
+
+// One "key=value" line per peer with traffic
+void stats_dump(const StatsTable *table, FILE *out, StatsSnapshot *prev);
+// Replace `path` atomically with a fresh dump
+int  stats_write_file(const StatsTable *table, const char *path, StatsSnapshot *prev);
+
+#endif // STATS_H
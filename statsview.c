@@ -0,0 +1,48 @@
+// statsview.c
+// Shows the counters a server started with -S publishes in shared memory,
+// refreshed every interval, with rates since the previous refresh
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    int interval_ms = 1000;
+    int count = 0;   // Refreshes before exiting (0 = until interrupted)
+    int clear = isatty(STDOUT_FILENO);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+        switch (opt) {
+            case 'i':
+                interval_ms = atoi(optarg);
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-i interval_ms] [-n count]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (interval_ms < 1 || count < 0) {
+        fprintf(stderr, "Interval must be positive and count not negative\n");
+        return 1;
+    }
+
+    const StatsTable *table = stats_map();
+    if (!table) {
+        fprintf(stderr, "No stats in shared memory (%s): is the server running with -S?\n",
+                STATS_SHM_NAME);
+        return 1;
+    }
+
+    StatsSnapshot snapshot = {0};
+    for (int i = 0; count == 0 || i < count; i++) {
+        if (i > 0) usleep(interval_ms * 1000);
+        if (clear) printf("\033[H\033[J");
+        stats_dump(table, stdout, &snapshot);
+        if (!clear) printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+// trace.c
+#include "trace.h"
+#include "sockets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+TraceEvent *trace_events;
+static size_t trace_capacity;
+static _Atomic uint64_t trace_head;  // Events ever recorded; the ring keeps the last ones
+
+static __thread uint32_t trace_tid;
+
+static const char *const type_names[16] = {
+    "ACK", "NACK", "OK_ACK", "FREE", "SIZE", "DATA", "TEXT", "VIDEO",
+    "IMAGE", "END_FILE", "RIGHT", "UP", "DOWN", "LEFT", "EXTENSION", "ERROR"
+};
+
+static const char *const kind_names[] = { "send", "recv", "ack", "handle", "write" };
+
+int trace_start(size_t capacity) {
+    if (capacity == 0) capacity = TRACE_DEFAULT_EVENTS;
+    TraceEvent *events = calloc(capacity, sizeof(TraceEvent));
+    if (!events) {
+        perror("calloc trace buffer failed");
+        return -1;
+    }
+    trace_capacity = capacity;
+    atomic_store(&trace_head, 0);
+    trace_events = events;
+    return 0;
+}
+
+void trace_stop(void) {
+    free(trace_events);
+    trace_events = NULL;
+}
+
+long long trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void trace_record(TraceKind kind, long long start_ns, long long end_ns,
+                  uint8_t seq, uint8_t type, uint16_t size, int32_t arg0, int32_t arg1) {
+    if (!trace_on()) return;
+    if (trace_tid == 0) trace_tid = syscall(SYS_gettid);
+
+    // Writers only race for a slot once the ring has wrapped all the way round
+    uint64_t index = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+    TraceEvent *event = &trace_events[index % trace_capacity];
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    event->tid = trace_tid;
+    event->size = size;
+    event->kind = kind;
+    event->seq = seq;
+    event->type = type;
+    event->arg[0] = arg0;
+    event->arg[1] = arg1;
+}
+
+void trace_frame(TraceKind kind, const void *frame, size_t len,
+                 long long start_ns, long long end_ns) {
+    const uint8_t *bytes = frame;
+    uint8_t seq = 0, type = 0xFF;
+    uint16_t size = 0;
+
+    if (len >= 3 && bytes[0] == START_MARKER) {
+        size = bytes[1] >> 1;
+        seq = ((bytes[1] & 1) << 4) | (bytes[2] >> 4);
+        type = bytes[2] & 0x0F;
+    } else if (len >= 5 && bytes[0] == EXT_MARKER) {
+        seq = bytes[1] & 0x1F;
+        type = bytes[2] & 0x0F;
+        size = ((uint16_t)bytes[3] << 8) | bytes[4];
+    }
+    trace_record(kind, start_ns, end_ns, seq, type, size, 0, 0);
+}
+
+int trace_enable_timestamps(int socket_fd) {
+    int on = 1;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+        perror("setsockopt SO_TIMESTAMPNS failed");
+        return -1;
+    }
+    return 0;
+}
+
+long long trace_realtime_to_ns(long long sec, long long nsec) {
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    long long offset = (real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+    return sec * 1000000000LL + nsec - offset;
+}
+
+long long trace_cmsg_ns(const struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            const struct timespec *ts = (const struct timespec *)CMSG_DATA(cmsg);
+            return trace_realtime_to_ns(ts->tv_sec, ts->tv_nsec);
+        }
+    }
+    return 0;
+}
+
+// Chrome trace timestamps are microseconds; keep the nanoseconds as decimals
+static void write_event(FILE *out, const TraceEvent *e, uint64_t id, int pid) {
+    const char *kind = kind_names[e->kind];
+    const char *type = e->type < 16 ? type_names[e->type] : "?";
+    double ts = e->start_ns / 1000.0;
+    double dur = (e->end_ns - e->start_ns) / 1000.0;
+
+    switch (e->kind) {
+        case TRACE_RECV:
+            // Arrival spans overlap the work on the thread: async slices
+            // get their own track instead of breaking the nesting
+            if (e->end_ns > e->start_ns) {
+                fprintf(out, "{\"name\":\"recv %s\",\"cat\":\"recv\",\"ph\":\"b\",\"id\":%lu,"
+                             "\"ts\":%.3f,\"pid\":%d,\"tid\":%u,"
+                             "\"args\":{\"seq\":%u,\"size\":%u}},\n",
+                        type, (unsigned long)id, ts, pid, e->tid, e->seq, e->size);
+                fprintf(out, "{\"name\":\"recv %s\",\"cat\":\"recv\",\"ph\":\"e\",\"id\":%lu,"
+                             "\"ts\":%.3f,\"pid\":%d,\"tid\":%u},\n",
+                        type, (unsigned long)id, e->end_ns / 1000.0, pid, e->tid);
+                return;
+            }
+            break;
+        case TRACE_ACK:
+            fprintf(out, "{\"name\":\"ack %u\",\"cat\":\"ack\",\"ph\":\"i\",\"s\":\"t\","
+                         "\"ts\":%.3f,\"pid\":%d,\"tid\":%u,"
+                         "\"args\":{\"type\":\"%s\",\"acked\":%d,\"rtt_us\":%d}},\n",
+                    e->seq, ts, pid, e->tid, type, e->arg[0], e->arg[1]);
+            return;
+        default:
+            break;
+    }
+
+    fprintf(out, "{\"name\":\"%s %s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"pid\":%d,\"tid\":%u,\"args\":{\"seq\":%u,\"size\":%u}},\n",
+            kind, type, kind, ts, dur, pid, e->tid, e->seq, e->size);
+}
+
+// Events recorded while writing may be torn once the ring wraps; stop
+// the traffic first for an exact picture
+int trace_write_json(const char *path) {
+    if (!trace_on()) return 0;
+
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        perror("fopen trace file failed");
+        return -1;
+    }
+
+    uint64_t head = atomic_load(&trace_head);
+    uint64_t first = head > trace_capacity ? head - trace_capacity : 0;
+    int pid = getpid();
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (uint64_t i = first; i < head; i++) {
+        write_event(out, &trace_events[i % trace_capacity], i, pid);
+    }
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                 "\"args\":{\"name\":\"treasure %d\"}}\n]}\n", pid, pid);
+
+    if (fclose(out) != 0) {
+        perror("write trace file failed");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+// trace.h
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define TRACE_DEFAULT_EVENTS (1 << 18)  // 8 MB of events; older ones are overwritten
+#define TRACE_CMSG_SIZE CMSG_SPACE(sizeof(struct timespec))  // Room for SCM_TIMESTAMPNS
+
+typedef enum {
+    TRACE_SEND,     // Frame handed to the kernel; spans the send call
+    TRACE_RECV,     // Frame received; spans kernel timestamp to user space
+    TRACE_ACK,      // ARQ sender processed an acknowledgement
+    TRACE_HANDLE,   // Server handled a frame, responses and window refill included
+    TRACE_WRITE     // Payload written to disk
+} TraceKind;
+
+// One timeline entry. Times are CLOCK_MONOTONIC nanoseconds, like
+// get_timestamp_us, with kernel timestamps converted on the way in.
+typedef struct {
+    long long start_ns, end_ns;
+    uint32_t tid;
+    uint16_t size;          // Payload bytes
+    uint8_t kind, seq, type;
+    int32_t arg[2];         // TRACE_ACK: frames acknowledged, RTT sample (us, -1 = none)
+} TraceEvent;
+
+// Non-NULL while tracing; hot paths test it before doing any work
+extern TraceEvent *trace_events;
+
+static inline int trace_on(void) {
+    return trace_events != NULL;
+}
+
+// Start recording into a ring of `capacity` events (call before threads start)
+int  trace_start(size_t capacity);
+void trace_stop(void);
+
+long long trace_now_ns(void);
+void trace_record(TraceKind kind, long long start_ns, long long end_ns,
+                  uint8_t seq, uint8_t type, uint16_t size, int32_t arg0, int32_t arg1);
+// Same, with seq, type and size read from a frame header of either format
+void trace_frame(TraceKind kind, const void *frame, size_t len,
+                 long long start_ns, long long end_ns);
+
+// Enable SO_TIMESTAMPNS so received frames carry the kernel's arrival time
+int       trace_enable_timestamps(int socket_fd);
+// Arrival time from a received message's control data (0 if it has none)
+long long trace_cmsg_ns(const struct msghdr *msg);
+// Kernel timestamps are wall-clock time; move one onto the monotonic clock
+long long trace_realtime_to_ns(long long sec, long long nsec);
+
+// Write the recorded events as Chrome trace JSON (chrome://tracing, Perfetto)
+int trace_write_json(const char *path);
+
+#endif // TRACE_H
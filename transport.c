@@ -0,0 +1,584 @@
+#include "transport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#define SIM_QUEUE_FRAMES  512   // Frames a simulated link holds per direction
+#define SIM_REORDER_US    500   // Hold of a reordered frame that nothing overtakes
+
+typedef struct {
+    const TransportOps *ops;
+    void *priv;
+} TransportEntry;
+
+static TransportEntry transports[TRANSPORT_MAX_FDS];
+
+const TransportOps *transport_for(int fd) {
+    if (fd < 0 || fd >= TRANSPORT_MAX_FDS || !transports[fd].ops) return &raw_transport;
+    return transports[fd].ops;
+}
+
+static void *transport_priv(int fd) {
+    if (fd < 0 || fd >= TRANSPORT_MAX_FDS) return NULL;
+    return transports[fd].priv;
+}
+
+int transport_register(int fd, const TransportOps *ops, void *priv) {
+    if (fd < 0 || fd >= TRANSPORT_MAX_FDS) {
+        fprintf(stderr, "descriptor %d too large for transport table\n", fd);
+        return -1;
+    }
+    transports[fd].ops = ops;
+    transports[fd].priv = priv;
+    return 0;
+}
+
+void transport_unregister(int fd) {
+    if (fd < 0 || fd >= TRANSPORT_MAX_FDS) return;
+    transports[fd].ops = NULL;
+    transports[fd].priv = NULL;
+}
+
+// Point-to-point backends have no link-layer addresses: frames appear to
+// come from a fixed, locally administered MAC per end, so servers still
+// tell their peers apart
+static void peer_address(struct sockaddr_ll *addr, uint8_t peer) {
+    if (!addr) return;
+    memset(addr, 0, sizeof(*addr));
+    addr->sll_family = AF_PACKET;
+    addr->sll_protocol = htons(ETH_P_TREASURE);
+    addr->sll_halen = ETH_ALEN;
+    addr->sll_addr[0] = 0x02;
+    addr->sll_addr[5] = peer;
+}
+
+static int fd_wait(int fd, int timeout_ms) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0) {
+        if (errno == EINTR) return 0;
+        perror("poll failed");
+        return -1;
+    }
+    return ready > 0;
+}
+
+static int no_flush(int fd) {
+    (void)fd;
+    return 0;
+}
+
+// UNIX socketpair: SOCK_SEQPACKET keeps frame boundaries, and the kernel
+// does the rest. The destination address is ignored.
+
+static ssize_t unix_send_iov(int fd, const struct iovec *iov, int iovcnt,
+                             const struct sockaddr_ll *addr) {
+    (void)addr;
+    struct msghdr msg = { .msg_iov = (struct iovec *)iov, .msg_iovlen = iovcnt };
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+static int unix_send_batch(int fd, struct mmsghdr *msgs, unsigned count) {
+    // Connected sockets refuse a destination, so send copies without one
+    struct mmsghdr local[count];
+    for (unsigned i = 0; i < count; i++) {
+        local[i] = msgs[i];
+        local[i].msg_hdr.msg_name = NULL;
+        local[i].msg_hdr.msg_namelen = 0;
+    }
+
+    unsigned sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(fd, local + sent, count - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("sendmmsg");
+            return sent > 0 ? (int)sent : -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+static ssize_t unix_recv(int fd, void *buf, size_t len, struct sockaddr_ll *addr, int flags) {
+    ssize_t received = recv(fd, buf, len, flags);
+    if (received >= 0) peer_address(addr, (uint8_t)(intptr_t)transport_priv(fd));
+    return received;
+}
+
+static int unix_recv_batch(int fd, void *bufs, size_t buf_size, size_t *lens,
+                           struct sockaddr_ll *addrs, unsigned max) {
+    struct mmsghdr msgs[max];
+    struct iovec iov[max];
+    for (unsigned i = 0; i < max; i++) {
+        iov[i].iov_base = (uint8_t *)bufs + i * buf_size;
+        iov[i].iov_len = buf_size;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n = recvmmsg(fd, msgs, max, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        perror("recvmmsg");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        lens[i] = msgs[i].msg_len;
+        peer_address(&addrs[i], (uint8_t)(intptr_t)transport_priv(fd));
+    }
+    return n;
+}
+
+static void unix_close(int fd) {
+    close(fd);
+}
+
+const TransportOps unix_transport = {
+    .name = "unix",
+    .send_iov = unix_send_iov,
+    .send_batch = unix_send_batch,
+    .recv = unix_recv,
+    .recv_batch = unix_recv_batch,
+    .wait = fd_wait,
+    .flush = no_flush,
+    .close = unix_close
+};
+
+int transport_socketpair(int fds[2]) {
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    // Each end sees frames from the other one
+    if (transport_register(fds[0], &unix_transport, (void *)2) < 0 ||
+        transport_register(fds[1], &unix_transport, (void *)1) < 0) {
+        transport_unregister(fds[0]);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    return 0;
+}
+
+// Simulated link: both ends live in this process. A sent frame is queued
+// at the other end with the time it would arrive on a link with the
+// configured bandwidth and latency, after loss, corruption, duplication
+// and reordering have been applied. Each end's descriptor is a timerfd
+// armed for the earliest queued arrival, so it polls readable exactly
+// when a frame is due.
+
+typedef struct {
+    long long deliver_at;   // Arrival time (us, CLOCK_MONOTONIC)
+    unsigned long order;    // Queue order among frames arriving together
+    size_t len;
+    uint8_t data[MAX_FRAME_SIZE];
+} SimFrame;
+
+typedef struct SimLink SimLink;
+
+typedef struct {
+    SimLink *link;
+    int fd;
+    int open;
+    uint8_t peer;                          // Address frames appear to come from
+    long long wire_free_us;                // When the wire towards this end is idle
+    unsigned long next_order;
+    SimFrame *heap[SIM_QUEUE_FRAMES];      // Min-heap on arrival time
+    int count;
+    SimFrame *free_list[SIM_QUEUE_FRAMES];
+    int free_count;
+    SimFrame *frames;
+    SimFrame *parked;                      // Reordered frame waiting to be overtaken
+    LinkStats stats;
+} SimEnd;
+
+struct SimLink {
+    pthread_mutex_t lock;
+    LinkConfig cfg;
+    unsigned seed;
+    SimEnd ends[2];
+};
+
+static int frame_before(const SimFrame *a, const SimFrame *b) {
+    if (a->deliver_at != b->deliver_at) return a->deliver_at < b->deliver_at;
+    return a->order < b->order;
+}
+
+static void heap_push(SimEnd *end, SimFrame *frame) {
+    int i = end->count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!frame_before(frame, end->heap[parent])) break;
+        end->heap[i] = end->heap[parent];
+        i = parent;
+    }
+    end->heap[i] = frame;
+}
+
+static SimFrame *heap_pop(SimEnd *end) {
+    SimFrame *top = end->heap[0];
+    SimFrame *last = end->heap[--end->count];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= end->count) break;
+        if (child + 1 < end->count && frame_before(end->heap[child + 1], end->heap[child])) child++;
+        if (!frame_before(end->heap[child], last)) break;
+        end->heap[i] = end->heap[child];
+        i = child;
+    }
+    if (end->count > 0) end->heap[i] = last;
+    return top;
+}
+
+// Take a frame out of the middle: float it to the top, then pop it
+static void heap_remove(SimEnd *end, SimFrame *frame) {
+    for (int i = 0; i < end->count; i++) {
+        if (end->heap[i] != frame) continue;
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            end->heap[i] = end->heap[parent];
+            end->heap[parent] = frame;
+            i = parent;
+        }
+        heap_pop(end);
+        return;
+    }
+}
+
+// Arm the end's timer for its earliest frame (or disarm it when empty)
+static void sim_arm(SimEnd *end) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (end->count > 0) {
+        long long at = end->heap[0]->deliver_at;
+        its.it_value.tv_sec = at / 1000000;
+        its.it_value.tv_nsec = (at % 1000000) * 1000;
+    }
+    timerfd_settime(end->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static double sim_random(SimLink *link) {
+    return rand_r(&link->seed) / ((double)RAND_MAX + 1.0);
+}
+
+static SimEnd *sim_end_for(int fd) {
+    return transport_priv(fd);
+}
+
+// Put one copy of a frame on the wire towards `to`
+static void sim_enqueue(SimLink *link, SimEnd *to, const struct iovec *iov, int iovcnt,
+                        size_t len, long long now) {
+    if (to->free_count == 0) {
+        to->stats.overflowed++;
+        return;
+    }
+
+    SimFrame *frame = to->free_list[--to->free_count];
+    size_t offset = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(frame->data + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    frame->len = len;
+
+    if (len > 0 && sim_random(link) < link->cfg.corrupt) {
+        size_t bit = (size_t)(sim_random(link) * len * 8);
+        frame->data[bit / 8] ^= 1u << (bit % 8);
+        to->stats.corrupted++;
+    }
+
+    // Frames leave one after another at the link rate, then propagate
+    long long start = now > to->wire_free_us ? now : to->wire_free_us;
+    long long tx_us = link->cfg.rate_bps > 0 ? (long long)(len * 8 * 1000000LL / link->cfg.rate_bps) : 0;
+    to->wire_free_us = start + tx_us;
+    frame->deliver_at = to->wire_free_us + link->cfg.latency_us;
+
+    frame->order = to->next_order++;
+
+    // A reordered frame swaps places with the next one: it is parked until
+    // that frame is queued and then arrives right behind it. Holding it for
+    // a fixed time instead would let it outlive the 5-bit sequence space.
+    SimFrame *parked = to->parked;
+    to->parked = NULL;
+    if (parked) {
+        heap_remove(to, parked);
+        parked->deliver_at = frame->deliver_at;
+        parked->order = to->next_order++;
+    }
+    if (!parked && sim_random(link) < link->cfg.reorder) {
+        frame->deliver_at += SIM_REORDER_US;  // In case nothing follows
+        to->parked = frame;
+        to->stats.reordered++;
+    }
+
+    heap_push(to, frame);
+    if (parked) heap_push(to, parked);
+    sim_arm(to);
+}
+
+static ssize_t sim_send_iov(int fd, const struct iovec *iov, int iovcnt,
+                            const struct sockaddr_ll *addr) {
+    (void)addr;
+    SimEnd *from = sim_end_for(fd);
+    if (!from) {
+        errno = EBADF;
+        return -1;
+    }
+
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    if (len > MAX_FRAME_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    SimLink *link = from->link;
+    pthread_mutex_lock(&link->lock);
+    SimEnd *to = &link->ends[from == &link->ends[0] ? 1 : 0];
+
+    // A frame towards a closed end vanishes, like one sent to an unplugged cable
+    if (to->open) {
+        long long now = get_timestamp_us();
+        to->stats.sent++;
+        if (sim_random(link) < link->cfg.loss) {
+            to->stats.lost++;
+        } else {
+            sim_enqueue(link, to, iov, iovcnt, len, now);
+            if (sim_random(link) < link->cfg.duplicate) {
+                to->stats.duplicated++;
+                sim_enqueue(link, to, iov, iovcnt, len, now);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&link->lock);
+    return len;
+}
+
+static int sim_send_batch(int fd, struct mmsghdr *msgs, unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+        if (sim_send_iov(fd, msgs[i].msg_hdr.msg_iov, msgs[i].msg_hdr.msg_iovlen, NULL) < 0) {
+            return i > 0 ? (int)i : -1;
+        }
+    }
+    return count;
+}
+
+// Take the next frame that has arrived; the caller holds the lock
+static ssize_t sim_take(SimEnd *end, void *buf, size_t len, struct sockaddr_ll *addr,
+                        long long now) {
+    if (end->count == 0 || end->heap[0]->deliver_at > now) return -1;
+
+    SimFrame *frame = heap_pop(end);
+    if (frame == end->parked) end->parked = NULL;
+    size_t copied = frame->len < len ? frame->len : len;
+    memcpy(buf, frame->data, copied);
+    peer_address(addr, end->peer);
+    end->free_list[end->free_count++] = frame;
+    end->stats.delivered++;
+    return copied;
+}
+
+// Clear the timer's expirations and arm it for whatever is still queued
+static void sim_rearm(SimEnd *end) {
+    uint64_t expirations;
+    if (read(end->fd, &expirations, sizeof(expirations)) < 0) {
+        // EAGAIN: the timer had not fired yet
+    }
+    sim_arm(end);
+}
+
+static ssize_t sim_recv(int fd, void *buf, size_t len, struct sockaddr_ll *addr, int flags) {
+    SimEnd *end = sim_end_for(fd);
+    if (!end) {
+        errno = EBADF;
+        return -1;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&end->link->lock);
+        ssize_t received = sim_take(end, buf, len, addr, get_timestamp_us());
+        sim_rearm(end);
+        pthread_mutex_unlock(&end->link->lock);
+        if (received >= 0) return received;
+
+        if (flags & MSG_DONTWAIT) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (fd_wait(fd, -1) < 0) return -1;
+    }
+}
+
+static int sim_recv_batch(int fd, void *bufs, size_t buf_size, size_t *lens,
+                          struct sockaddr_ll *addrs, unsigned max) {
+    SimEnd *end = sim_end_for(fd);
+    if (!end) return -1;
+
+    pthread_mutex_lock(&end->link->lock);
+    long long now = get_timestamp_us();
+    unsigned count = 0;
+    while (count < max) {
+        ssize_t received = sim_take(end, (uint8_t *)bufs + count * buf_size, buf_size,
+                                    &addrs[count], now);
+        if (received < 0) break;
+        lens[count++] = received;
+    }
+    sim_rearm(end);
+    pthread_mutex_unlock(&end->link->lock);
+    return count;
+}
+
+static void sim_close(int fd) {
+    SimEnd *end = sim_end_for(fd);
+    if (!end) {
+        close(fd);
+        return;
+    }
+
+    SimLink *link = end->link;
+    pthread_mutex_lock(&link->lock);
+    end->open = 0;
+    close(end->fd);
+    int last = !link->ends[0].open && !link->ends[1].open;
+    pthread_mutex_unlock(&link->lock);
+
+    // The second end to close frees the link
+    if (last) {
+        free(link->ends[0].frames);
+        free(link->ends[1].frames);
+        pthread_mutex_destroy(&link->lock);
+        free(link);
+    }
+}
+
+const TransportOps sim_transport = {
+    .name = "sim",
+    .send_iov = sim_send_iov,
+    .send_batch = sim_send_batch,
+    .recv = sim_recv,
+    .recv_batch = sim_recv_batch,
+    .wait = fd_wait,
+    .flush = no_flush,
+    .close = sim_close
+};
+
+int transport_simlink(const LinkConfig *cfg, int fds[2]) {
+    SimLink *link = calloc(1, sizeof(SimLink));
+    if (!link) {
+        perror("calloc");
+        return -1;
+    }
+    pthread_mutex_init(&link->lock, NULL);
+    link->cfg = *cfg;
+    link->seed = cfg->seed;
+
+    link->ends[0].fd = link->ends[1].fd = -1;
+
+    int opened = 0;
+    for (int i = 0; i < 2; i++) {
+        SimEnd *end = &link->ends[i];
+        end->link = link;
+        end->peer = 2 - i;
+        end->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        end->frames = calloc(SIM_QUEUE_FRAMES, sizeof(SimFrame));
+        if (end->fd < 0 || !end->frames ||
+            transport_register(end->fd, &sim_transport, end) < 0) {
+            perror("simulated link setup");
+            break;
+        }
+        for (int j = 0; j < SIM_QUEUE_FRAMES; j++) {
+            end->free_list[j] = &end->frames[j];
+        }
+        end->free_count = SIM_QUEUE_FRAMES;
+        end->open = 1;
+        fds[i] = end->fd;
+        opened++;
+    }
+
+    if (opened < 2) {
+        for (int i = 0; i < 2; i++) {
+            SimEnd *end = &link->ends[i];
+            if (end->fd >= 0) {
+                transport_unregister(end->fd);
+                close(end->fd);
+            }
+            free(end->frames);
+        }
+        pthread_mutex_destroy(&link->lock);
+        free(link);
+        return -1;
+    }
+    return 0;
+}
+
+int link_stats(int fd, LinkStats *stats) {
+    if (transport_for(fd) != &sim_transport) return -1;
+    SimEnd *end = sim_end_for(fd);
+
+    pthread_mutex_lock(&end->link->lock);
+    *stats = end->stats;
+    pthread_mutex_unlock(&end->link->lock);
+    return 0;
+}
+
+// Rates take k, m and g suffixes (powers of 1000)
+static long long parse_rate(const char *value) {
+    char *end;
+    double rate = strtod(value, &end);
+    switch (*end) {
+        case 'k': case 'K': rate *= 1e3; break;
+        case 'm': case 'M': rate *= 1e6; break;
+        case 'g': case 'G': rate *= 1e9; break;
+        default: break;
+    }
+    return (long long)rate;
+}
+
+int link_config_parse(const char *spec, LinkConfig *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->seed = 1;
+    if (!spec) return 0;
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    char *save;
+    for (char *item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(item, '=');
+        if (!value) {
+            fprintf(stderr, "Link option '%s' needs a value\n", item);
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (strcmp(item, "loss") == 0) {
+            cfg->loss = atof(value);
+        } else if (strcmp(item, "corrupt") == 0) {
+            cfg->corrupt = atof(value);
+        } else if (strcmp(item, "dup") == 0) {
+            cfg->duplicate = atof(value);
+        } else if (strcmp(item, "reorder") == 0) {
+            cfg->reorder = atof(value);
+        } else if (strcmp(item, "latency") == 0) {
+            cfg->latency_us = atoll(value);
+        } else if (strcmp(item, "rate") == 0) {
+            cfg->rate_bps = parse_rate(value);
+        } else if (strcmp(item, "seed") == 0) {
+            cfg->seed = strtoul(value, NULL, 0);
+        } else {
+            fprintf(stderr, "Unknown link option '%s'\n", item);
+            return -1;
+        }
+    }
+    return 0;
+}
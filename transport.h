@@ -0,0 +1,61 @@
+// transport.h
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "sockets.h"
+
+#define TRANSPORT_MAX_FDS 1024
+
+// What carries frames for one descriptor. The socket_* calls in sockets.c
+// dispatch through these, so the ARQ layer, server and client run
+// unchanged over any backend.
+typedef struct {
+    const char *name;
+    ssize_t (*send_iov)(int fd, const struct iovec *iov, int iovcnt,
+                        const struct sockaddr_ll *addr);
+    int     (*send_batch)(int fd, struct mmsghdr *msgs, unsigned count);
+    ssize_t (*recv)(int fd, void *buf, size_t len, struct sockaddr_ll *addr, int flags);
+    int     (*recv_batch)(int fd, void *bufs, size_t buf_size, size_t *lens,
+                          struct sockaddr_ll *addrs, unsigned max);
+    int     (*wait)(int fd, int timeout_ms);
+    int     (*flush)(int fd);
+    void    (*close)(int fd);
+} TransportOps;
+
+extern const TransportOps raw_transport;   // AF_PACKET socket (the default)
+extern const TransportOps unix_transport;  // UNIX socketpair
+extern const TransportOps sim_transport;   // In-memory simulated link
+
+// Impairments of a simulated link, applied to each direction on its own.
+// Probabilities are in [0, 1]; zero values give a perfect, instant link.
+typedef struct {
+    double loss;            // Frame dropped
+    double corrupt;         // One bit flipped
+    double duplicate;       // Frame delivered twice
+    double reorder;         // Frame held back so later ones overtake it
+    long long latency_us;   // One-way propagation delay
+    long long rate_bps;     // Bandwidth in bits per second (0 = unlimited)
+    unsigned seed;          // Random seed, for reproducible runs
+} LinkConfig;
+
+// Counters for one direction of a simulated link
+typedef struct {
+    unsigned long sent, delivered, lost, corrupted, duplicated, reordered, overflowed;
+} LinkStats;
+
+// Registry: the backend behind each descriptor (raw_transport if none)
+const TransportOps *transport_for(int fd);
+int  transport_register(int fd, const TransportOps *ops, void *priv);
+void transport_unregister(int fd);
+
+// Both return two connected descriptors, one per end, usable with every
+// socket_* call and with poll/epoll; release each with close_raw_socket
+int  transport_socketpair(int fds[2]);
+int  transport_simlink(const LinkConfig *cfg, int fds[2]);
+
+// "loss=0.01,corrupt=0.001,dup=0,reorder=0.01,latency=200,rate=100m,seed=1"
+int  link_config_parse(const char *spec, LinkConfig *cfg);
+// Frames sent towards the end `fd`
+int  link_stats(int fd, LinkStats *stats);
+
+#endif // TRANSPORT_H